@@ -13,25 +13,64 @@
 // linux
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <dirent.h>
+
+#ifdef LOG4CPP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#include <sched.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <pthread.h>
+#include <sys/uio.h>
+#include <signal.h>
+
+// io_uring through raw syscalls, no liburing needed.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define LOG4CPP_HAS_IO_URING 1
+#endif
+#endif
 
 // C++ std
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
-#include <list>
 #include <thread>
 
 #include <iostream>
 #include <fstream>
+#include <iterator>
 
 #include <exception>
+#include <stdexcept>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
 #include <string>
+#include <algorithm>
 #include <memory>
 #include <map>
+#include <unordered_map>
+#include <set>
+#include <chrono>
 #include <vector>
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 namespace Log4CPP
 {
@@ -40,9 +79,14 @@ class Utility
 {
     Utility();
 public:
+    // gettid is cached per thread, a forked child drops the cache.
     static unsigned int CurrentThreadID()
     {
-        return syscall(SYS_gettid);
+        unsigned int& tid = CachedThreadID();
+        if( tid == 0 )
+            tid = syscall(SYS_gettid);
+
+        return tid;
     }
 
     static std::string CurrentWorkDirectory()
@@ -58,478 +102,4857 @@ public:
 
         return current_directory;
     }
+
+private:
+    static unsigned int& CachedThreadID()
+    {
+        static thread_local unsigned int _tid = 0;
+        static bool _registered = RegisterAtFork();
+        (void)_registered;
+        return _tid;
+    }
+
+    static bool RegisterAtFork()
+    {
+        pthread_atfork(nullptr, nullptr, []{ CachedThreadID() = 0; });
+        return true;
+    }
 };
 
-enum class Level : int
+/**
+ * what a thread tags its log lines with: its name and the rendered
+ * key/value context. immutable, events share it instead of copying.
+ */
+struct ThreadTag
 {
-    ALL = 0,    // open all level.
-    DEBUG,
-    INFO,
-    WARN,
-    ERROR,
-    FATAL,
-    OFF         // turn off all level.
+    std::string name;
+    std::string context;    // "key=value key=value"
 };
 
-class LogEvent
+/**
+ * per thread name and MDC style key/value context.
+ *
+ * the context is rendered once when it changes, not per log line; threads
+ * with neither name nor context tag their events with nothing.
+ */
+class ThreadContext
 {
+    ThreadContext();
 public:
-    LogEvent(int thread_id, const char* module, const Level log_level, const char* log_text)
-        : _thread_id(thread_id), _module(module), _level(log_level), _text(log_text)
+    static void SetThreadName(const std::string& name)
     {
-        gettimeofday(&_timestamp, NULL);
+        Local& local = Current();
+        local._name = name;
+        local.Rebuild();
+    }
+    static const std::string& ThreadName()
+    {
+        return Current()._name;
     }
 
-    LogEvent(const LogEvent& other) = default;
-    LogEvent(const LogEvent&& other)
+    static void Put(const std::string& key, const std::string& value)
     {
-        this->_thread_id = other._thread_id;
-        this->_module = other._module;
-        this->_level = other._level;
-        this->_text = std::move(other._text);
-        this->_timestamp = other._timestamp;
+        Local& local = Current();
+        for(auto& entry : local._context){
+            if( entry.first == key ){
+                entry.second = value;
+                local.Rebuild();
+                return;
+            }
+        }
+
+        local._context.emplace_back(key, value);
+        local.Rebuild();
     }
-    LogEvent& operator= (const LogEvent&& other)
+    static std::string Get(const std::string& key)
     {
-        this->_thread_id = other._thread_id;
-        this->_module = other._module;
-        this->_level = other._level;
-        this->_text = std::move(other._text);
-        this->_timestamp = other._timestamp;
-        return *this;
+        std::string value;
+        Get(key, value);
+        return value;
     }
+    // false if key isn't set.
+    static bool Get(const std::string& key, std::string& value)
+    {
+        for(auto& entry : Current()._context){
+            if( entry.first == key ){
+                value = entry.second;
+                return true;
+            }
+        }
 
-    const int ThreadID() const { return _thread_id;}
-    const char* Module() const { return _module;}
-    const timeval& Timestamp() const { return _timestamp;}
-    const Level& LogLevel() const { return _level;}
-    const std::string& Text() const { return _text;}
+        return false;
+    }
+    static void Remove(const std::string& key)
+    {
+        Local& local = Current();
+        for(auto iter = local._context.begin(); iter != local._context.end(); ++iter){
+            if( iter->first == key ){
+                local._context.erase(iter);
+                local.Rebuild();
+                return;
+            }
+        }
+    }
+    static void Clear()
+    {
+        Local& local = Current();
+        local._context.clear();
+        local.Rebuild();
+    }
+
+    // null while the thread has neither name nor context.
+    static const std::shared_ptr<const ThreadTag>& Tag()
+    {
+        return Current()._tag;
+    }
 
 private:
-    int _thread_id;
-    const char* _module;
-    Level _level;
-    std::string _text;
+    struct Local
+    {
+        std::string _name;
+        std::vector<std::pair<std::string, std::string>> _context;
+        std::shared_ptr<const ThreadTag> _tag;
+
+        void Rebuild()
+        {
+            if( _name.empty() && _context.empty() ){
+                _tag.reset();
+                return;
+            }
+
+            std::shared_ptr<ThreadTag> tag(new ThreadTag);
+            tag->name = _name;
+            for(auto& entry : _context){
+                if( !tag->context.empty() )
+                    tag->context.append(" ");
+                tag->context.append(entry.first).append("=").append(entry.second);
+            }
+            _tag = tag;
+        }
+    };
 
-    struct timeval _timestamp;
+    static Local& Current()
+    {
+        static thread_local Local _local;
+        return _local;
+    }
 };
 
 /**
- * log global Configure
- * 
- * config param:
- * 1: lowset level
- * 2: back up log file count
- * 3: max log file size unit MB.
- * 
- * NOTE:
- * Set configure on first.
- * 
+ * puts a context key for the current scope, e.g. a request id. the
+ * value the key had before, or its absence, comes back at scope exit,
+ * so scopes with the same key nest.
  */
-class Configure
+class ScopedContext
 {
-    Configure()
+public:
+    ScopedContext(const std::string& key, const std::string& value) : _key(key)
     {
-        _work_dir = Utility::CurrentWorkDirectory();
+        _had_previous = ThreadContext::Get(key, _previous);
+        ThreadContext::Put(key, value);
     }
-
-public:
-    Configure(const Configure&) = delete;
-    Configure& operator=(const Configure&) = delete;
-
-    Configure(const Configure&&) = delete;
-    Configure& operator=(const Configure&&) = delete;
-
-    static Configure& Instance()
+    ~ScopedContext()
     {
-        static Configure _instance;
-        return _instance;
+        if( _had_previous )
+            ThreadContext::Put(_key, _previous);
+        else
+            ThreadContext::Remove(_key);
     }
 
-    /**
-     * set dir for saving files, should be end with "/".
-     * 
-     * NOTE:
-     * use local path if not set this.
-     */
-    void SetDirectory(const char* dir) { _work_dir.assign(dir); }
-    const char* GetDirectory() const { return _work_dir.c_str(); }
-
-    void SetLowestLevel(const Level& level) { _lowest_level = level; }
-    const Level& GetLowestLevel() const { return _lowest_level; }
-
-    void SetBackupCount(unsigned int count) { _log_back_count = count; }
-    unsigned int GetBackupCount() const { return _log_back_count; }
-
-    // unit:MB.
-    void SetLogFileMaxSize(unsigned int size)
-    { 
-        if( size == 0 || size > 10 * 1024)
-            throw std::invalid_argument("valid range: (0M, 10G].");
-
-        _file_max_size = size; 
-    }
-    unsigned int GetLogFileMaxSize() const { return _file_max_size; }
+    ScopedContext(const ScopedContext&) = delete;
+    ScopedContext& operator= (const ScopedContext&) = delete;
 
 private:
-    std::string _work_dir;
+    std::string _key;
+    std::string _previous;
+    bool _had_previous{false};
+};
 
-    Level _lowest_level = Level::ALL;
-    unsigned int _log_back_count = 0;
-    unsigned int _file_max_size = 3; // MB
+enum class Level : int
+{
+    ALL = 0,    // open all level.
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    FATAL,
+    OFF         // turn off all level.
 };
 
-class Formatter
+/**
+ * what a full appender queue does with a new event.
+ */
+enum class OverflowPolicy : int
 {
-protected:
-    virtual ~Formatter() {};
+    BLOCK = 0,          // the producer waits for room.
+    DROP_NEWEST,        // the new event is dropped.
+    DROP_OLDEST,        // the oldest queued event is dropped to make room.
+    DROP_BELOW_LEVEL    // events below the overflow level are dropped, others wait.
+};
 
+/**
+ * when a buffering appender writes its lines out, whichever comes
+ * first. the default writes every batch out, like std::endl did.
+ */
+struct FlushPolicy
+{
+    size_t bytes{0};                // once this much is buffered, 0 is every batch.
+    unsigned int interval_ms{0};    // at the latest this long after the first buffered line, 0 is off.
+    Level level{Level::ERROR};      // at once after a batch holding an event of this level or above.
+};
+
+/**
+ * growable char buffer.
+ *
+ * Clear() keeps the memory, so a buffer reused by one writer stops
+ * allocating once it has grown to the working size.
+ */
+class LogBuffer
+{
 public:
-    std::string Format(const LogEvent& e)
+    LogBuffer() = default;
+    ~LogBuffer()
     {
-        std::string log_str = std::move(this->FormatHeader(e));
-        log_str.append(e.Text());
-
-        return std::move(log_str);
+        free(_data);
     }
 
-protected:
-    virtual std::string FormatHeader(const LogEvent& e) = 0;
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
 
-    std::string FormatTimestamp(const timeval& tv)
+    void Append(const char* data, size_t len)
     {
-        time_t _now = tv.tv_sec;
-        struct tm _tm_now;
-        localtime_r(&_now, &_tm_now);
-
-        char time_str[32] = {0};
-        size_t len = strftime(time_str, sizeof(time_str), "%Y%m%d-%H:%M:%S", &_tm_now);
-        sprintf(time_str + len, ".%03d", (int)(tv.tv_usec/1000));
+        Reserve(_size + len);
+        memcpy(_data + _size, data, len);
+        _size += len;
+    }
+    void Append(const char* str)
+    {
+        Append(str, strlen(str));
+    }
+    void Append(const std::string& str)
+    {
+        Append(str.data(), str.size());
+    }
+    void Append(char c)
+    {
+        Reserve(_size + 1);
+        _data[_size++] = c;
+    }
+    void AppendUnsigned(uint64_t value)
+    {
+        char digits[20];
+        size_t len = 0;
+        do{
+            digits[sizeof(digits) - ++len] = '0' + value % 10;
+            value /= 10;
+        }while( value != 0 );
 
-        return time_str;
+        Append(digits + sizeof(digits) - len, len);
     }
 
-    const char* FormatLevel(Level level) const
+    void Reserve(size_t capacity)
     {
-        switch(level)
-        {
-        case Level::DEBUG: return "[DEBUG]";
-        case Level::INFO:  return "[INFO] ";
-        case Level::WARN:  return "[WARN] ";
-        case Level::ERROR: return "[ERROR]";
-        case Level::FATAL: return "[FATAL]";
-        default: 
-            return "[UNKNOWN]";
-        }
+        if( capacity <= _capacity )
+            return;
 
-        return "";
+        size_t new_capacity = _capacity == 0 ? 256 : _capacity;
+        while( new_capacity < capacity ) new_capacity <<= 1;
+
+        char* new_data = static_cast<char*>(realloc(_data, new_capacity));
+        if( new_data == nullptr )
+            throw std::bad_alloc();
+
+        _data = new_data;
+        _capacity = new_capacity;
     }
+
+    void Clear() { _size = 0; }
+
+    const char* Data() const { return _data; }
+    size_t Size() const { return _size; }
+    bool Empty() const { return _size == 0; }
+
+private:
+    char* _data{nullptr};
+    size_t _size{0};
+    size_t _capacity{0};
 };
 
-class ConsoleFormatter
-    : public Formatter
-    , public std::enable_shared_from_this<ConsoleFormatter>
+/**
+ * compile time checks of "{}" formats, following the rules of
+ * LogArgs::Render, used by the LOGF_* macros.
+ *
+ * the scan recurses once per character, formats longer than the
+ * compiler's constexpr depth (512 by default) need -fconstexpr-depth.
+ */
+class FormatCheck
 {
+    FormatCheck();
 public:
-    ~ConsoleFormatter() {}
+    // number of "{}" placeholders, -1 for a lone '{' or '}'.
+    static constexpr int Placeholders(const char* format, int count = 0)
+    {
+        return *format == '\0' ? count
+            : IsPair(format, '{', '{') || IsPair(format, '}', '}') ? Placeholders(format + 2, count)
+            : IsPair(format, '{', '}') ? Placeholders(format + 2, count + 1)
+            : *format == '{' || *format == '}' ? -1
+            : Placeholders(format + 1, count);
+    }
+
+    // only for decltype: the argument count as a constant.
+    template<typename... Args>
+    static std::integral_constant<int, sizeof...(Args)> Count(const Args&... args);
 
-public:
 private:
-    std::string FormatHeader(const LogEvent& e) override
+    static constexpr bool IsPair(const char* format, char first, char second)
     {
-        std::string header;
-        header.append("[").append(FormatTimestamp(e.Timestamp())).append("] ");
-        header.append("[").append(std::to_string(e.ThreadID())).append("] ");
-        header.append("[").append(e.Module()).append("] ");
-        header.append(FormatLevel(e.LogLevel())).append(" ");
-        return std::move(header);
+        return format[0] == first && format[1] == second;
     }
 };
 
-class FileFormatter
-    : public Formatter
-    , public std::enable_shared_from_this<FileFormatter>
+/**
+ * format of a deferred log line.
+ *
+ * the pointer is kept and only read later on the writer thread, so it
+ * is only made from a string literal: a runtime string (c_str(), a char
+ * buffer) doesn't compile. runtime text goes through the one argument
+ * Debug(const char*) and friends, which copy it.
+ */
+class LogFormat
 {
 public:
+    template<size_t N>
+    constexpr LogFormat(const char (&format)[N]) : _format(format) {}
+    // a writable array is most likely a buffer on the stack.
+    template<size_t N>
+    LogFormat(char (&format)[N]) = delete;
+
+    constexpr const char* Str() const { return _format; }
+
 private:
-    std::string FormatHeader(const LogEvent& e) override
-    {
-        std::string header;
-        header.append("[").append(std::move(FormatTimestamp(e.Timestamp()))).append("] ");
-        header.append("[").append(std::to_string(e.ThreadID())).append("] ");
-        header.append(FormatLevel(e.LogLevel())).append(" ");
-        return std::move(header);
-    }
+    const char* _format;
 };
 
-class Appender
-{
-class Work
+/**
+ * raw arguments of a deferred log line.
+ *
+ * the calling thread only copies each argument's bytes behind a one byte
+ * type tag; the text is rendered later, on the appender's writer thread,
+ * by substituting the arguments for the "{}" placeholders of the static
+ * format string ("{{" and "}}" are literal braces).
+ *
+ * small argument lists are kept inline, so capturing them doesn't
+ * allocate.
+ */
+class LogArgs
 {
+    static const size_t INLINE_SIZE = 48;
+
 public:
-    Work(Appender* appender) : _appender(appender)
+    enum Type : char
     {
-    }
+        BOOL = 0,
+        CHAR,
+        INT32,
+        UINT32,
+        INT64,
+        UINT64,
+        FLOAT,
+        DOUBLE,
+        LONG_DOUBLE,
+        STRING,
+        POINTER
+    };
 
-    void Post(const LogEvent& e)
+public:
+    template<typename... Args>
+    void Encode(const Args&... args)
     {
-        if( !_stop ){
-            std::lock_guard<std::mutex> lock(_queue_mtx);
-            _log_queue.push_back(std::move(e));
-            _queue_cond.notify_all();
-        }
+        size_t size = 0;
+        int sizes[] = {0, (size += EncodedSize(args), 0)...};
+        (void)sizes;
+
+        char* out = Allocate(size);
+        int puts[] = {0, (out = Put(out, args), 0)...};
+        (void)puts;
     }
 
-    void Stop()
+    /**
+     * append format to out, with the placeholders replaced by the
+     * arguments. placeholders without an argument are kept verbatim.
+     */
+    void Render(const char* format, LogBuffer& out) const
     {
-        _stop = true;
+        const char* pos = Data();
+        const char* end = pos + _size;
 
-        {
-            std::lock_guard<std::mutex> lock(_queue_mtx);
-            _queue_cond.notify_all();
+        const char* literal = format;
+        while( *format != '\0' ){
+            if( (format[0] == '{' && format[1] == '{') || (format[0] == '}' && format[1] == '}') ){
+                out.Append(literal, format - literal + 1);
+                format += 2;
+                literal = format;
+            }else if( format[0] == '{' && format[1] == '}' && pos < end ){
+                out.Append(literal, format - literal);
+                pos = RenderOne(pos, end, out);
+                format += 2;
+                literal = format;
+            }else{
+                format++;
+            }
         }
 
-        if( _log_loop_thread.joinable() )
-            _log_loop_thread.join();
-
+        out.Append(literal, format - literal);
     }
 
-    void Start()
+    // take already encoded arguments, e.g. read back from a binary log.
+    void Assign(const char* data, size_t size)
     {
-        _stop = false;
-        _log_loop_thread = std::thread(&Work::WriteLogThread, this);
-        while( !_thread_exec );
+        memcpy(Allocate(size), data, size);
     }
 
-    void Restart()
+    // append one more argument, for lists built piece by piece.
+    template<typename T>
+    void Add(const T& val)
     {
-        Stop();
-        Start();
+        Put(Extend(EncodedSize(val)), val);
     }
 
-private:
-    void WriteLogThread()
+    size_t Size() const { return _size; }
+    bool Empty() const { return _size == 0; }
+    const char* Data() const { return _size > INLINE_SIZE ? &_spill[0] : _inline; }
+    const char* End() const { return Data() + _size; }
+
+    /**
+     * one decoded argument, str points into the encoded data for STRING.
+     */
+    struct Value
     {
-        _thread_exec = true;
+        Type type;
+        union
+        {
+            bool b;
+            char c;
+            int64_t i;
+            uint64_t u;
+            float f;
+            double d;
+            long double ld;
+            const void* p;
+        };
+        const char* str;
+        uint32_t len;
+    };
 
-        while(!_stop){
-            std::unique_lock<std::mutex> lock(_queue_mtx);
-            _queue_cond.wait(lock, [this]{ return !_log_queue.empty() || _stop;});
+    /**
+     * decode the argument at pos and move pos to the next one. false for
+     * an unknown type or a length past end, e.g. a corrupt binary log.
+     */
+    static bool Read(const char*& pos, const char* end, Value& value)
+    {
+        if( pos >= end )
+            return false;
 
-            if( _stop ) break;
-            Pop();
+        value.type = static_cast<Type>(*pos++);
+        switch(value.type)
+        {
+        case BOOL: { char val; if( !GetRaw(pos, end, val) ) return false; value.b = val != 0; return true; }
+        case CHAR: return GetRaw(pos, end, value.c);
+        case INT32: { int32_t val; if( !GetRaw(pos, end, val) ) return false; value.i = val; return true; }
+        case UINT32: { uint32_t val; if( !GetRaw(pos, end, val) ) return false; value.u = val; return true; }
+        case INT64: { int64_t val; if( !GetRaw(pos, end, val) ) return false; value.i = val; return true; }
+        case UINT64: { uint64_t val; if( !GetRaw(pos, end, val) ) return false; value.u = val; return true; }
+        case FLOAT: return GetRaw(pos, end, value.f);
+        case DOUBLE: return GetRaw(pos, end, value.d);
+        case LONG_DOUBLE: return GetRaw(pos, end, value.ld);
+        case STRING:
+        {
+            if( !GetRaw(pos, end, value.len) || value.len > static_cast<size_t>(end - pos) )
+                return false;
+            value.str = pos;
+            pos += value.len;
+            return true;
+        }
+        case POINTER: return GetRaw(pos, end, value.p);
         }
 
-        while( !_log_queue.empty() ) Pop();
-        _thread_exec = false;
+        return false;
     }
 
-    void Pop()
+    // every argument reads back, nothing is left over.
+    bool Valid() const
     {
-        LogEvent log_ev = std::move(_log_queue.front());
-        _log_queue.pop_front();
+        Value value;
+        const char* pos = Data();
+        while( pos < End() ){
+            if( !Read(pos, End(), value) )
+                return false;
+        }
+        return true;
+    }
+
+    // the value as text, the way "{}" renders it.
+    static void RenderValue(const Value& value, LogBuffer& out)
+    {
+        char buffer[64];
+        int len = 0;
+
+        switch(value.type)
+        {
+        case BOOL: out.Append(value.b ? "true" : "false"); break;
+        case CHAR: out.Append(value.c); break;
+        case INT32: case INT64: AppendInteger(value.i, out); break;
+        case UINT32: case UINT64: out.AppendUnsigned(value.u); break;
+        case FLOAT: len = snprintf(buffer, sizeof(buffer), "%f", value.f); break;
+        case DOUBLE: len = snprintf(buffer, sizeof(buffer), "%f", value.d); break;
+        case LONG_DOUBLE: len = snprintf(buffer, sizeof(buffer), "%Lf", value.ld); break;
+        case STRING: out.Append(value.str, value.len); break;
+        case POINTER: len = snprintf(buffer, sizeof(buffer), "%p", value.p); break;
+        }
 
-        _appender->Output(_appender->Format(log_ev));
+        if( len > 0 )
+            out.Append(buffer, std::min<size_t>(len, sizeof(buffer) - 1));
     }
 
 private:
-    std::list<LogEvent> _log_queue;
-    std::mutex _queue_mtx;
-    std::condition_variable _queue_cond;
-
-    std::atomic_bool _stop {true};
-    std::thread _log_loop_thread;
-    std::atomic_bool _thread_exec {false};
+    char* Allocate(size_t size)
+    {
+        _size = size;
+        if( size <= INLINE_SIZE )
+            return _inline;
 
-    Appender* _appender{nullptr};
-};
+        _spill.resize(size);
+        return &_spill[0];
+    }
 
-    friend class Logger;
-protected:
-    Appender() : _worker(this)
+    // room for size more bytes at the end, moving inline data to the spill.
+    char* Extend(size_t size)
     {
+        size_t old_size = _size;
+        _size += size;
+        if( _size <= INLINE_SIZE )
+            return _inline + old_size;
+
+        if( old_size <= INLINE_SIZE )
+            _spill.assign(_inline, old_size);
+        _spill.resize(_size);
+        return &_spill[old_size];
     }
 
-public:
-    virtual ~Appender() {}
+    static size_t EncodedSize(bool) { return 1 + 1; }
+    static size_t EncodedSize(char) { return 1 + 1; }
+    static size_t EncodedSize(signed char) { return 1 + 4; }
+    static size_t EncodedSize(unsigned char) { return 1 + 4; }
+    static size_t EncodedSize(short) { return 1 + 4; }
+    static size_t EncodedSize(unsigned short) { return 1 + 4; }
+    static size_t EncodedSize(int) { return 1 + 4; }
+    static size_t EncodedSize(unsigned int) { return 1 + 4; }
+    static size_t EncodedSize(long) { return 1 + 8; }
+    static size_t EncodedSize(unsigned long) { return 1 + 8; }
+    static size_t EncodedSize(long long) { return 1 + 8; }
+    static size_t EncodedSize(unsigned long long) { return 1 + 8; }
+    static size_t EncodedSize(float) { return 1 + sizeof(float); }
+    static size_t EncodedSize(double) { return 1 + sizeof(double); }
+    static size_t EncodedSize(long double) { return 1 + sizeof(long double); }
+    static size_t EncodedSize(const char* val) { return 1 + 4 + (val ? strlen(val) : 6); }
+    static size_t EncodedSize(const std::string& val) { return 1 + 4 + val.size(); }
+    static size_t EncodedSize(const void*) { return 1 + sizeof(void*); }
 
-    virtual void SetFormatter(const std::shared_ptr<Log4CPP::Formatter>& formatter)
+    template<typename T>
+    static char* PutRaw(char* out, Type type, T val)
     {
-        _log_formatter = formatter;
+        *out++ = type;
+        memcpy(out, &val, sizeof(val));
+        return out + sizeof(val);
     }
+    static char* PutString(char* out, const char* val, uint32_t len)
+    {
+        *out++ = STRING;
+        memcpy(out, &len, sizeof(len));
+        memcpy(out + sizeof(len), val, len);
+        return out + sizeof(len) + len;
+    }
+
+    static char* Put(char* out, bool val) { return PutRaw<char>(out, BOOL, val ? 1 : 0); }
+    static char* Put(char* out, char val) { return PutRaw<char>(out, CHAR, val); }
+    static char* Put(char* out, signed char val) { return PutRaw<int32_t>(out, INT32, val); }
+    static char* Put(char* out, unsigned char val) { return PutRaw<uint32_t>(out, UINT32, val); }
+    static char* Put(char* out, short val) { return PutRaw<int32_t>(out, INT32, val); }
+    static char* Put(char* out, unsigned short val) { return PutRaw<uint32_t>(out, UINT32, val); }
+    static char* Put(char* out, int val) { return PutRaw<int32_t>(out, INT32, val); }
+    static char* Put(char* out, unsigned int val) { return PutRaw<uint32_t>(out, UINT32, val); }
+    static char* Put(char* out, long val) { return PutRaw<int64_t>(out, INT64, val); }
+    static char* Put(char* out, unsigned long val) { return PutRaw<uint64_t>(out, UINT64, val); }
+    static char* Put(char* out, long long val) { return PutRaw<int64_t>(out, INT64, val); }
+    static char* Put(char* out, unsigned long long val) { return PutRaw<uint64_t>(out, UINT64, val); }
+    static char* Put(char* out, float val) { return PutRaw<float>(out, FLOAT, val); }
+    static char* Put(char* out, double val) { return PutRaw<double>(out, DOUBLE, val); }
+    static char* Put(char* out, long double val) { return PutRaw<long double>(out, LONG_DOUBLE, val); }
+    static char* Put(char* out, const char* val)
+    {
+        if( val == nullptr )
+            return PutString(out, "(null)", 6);
+
+        return PutString(out, val, strlen(val));
+    }
+    static char* Put(char* out, const std::string& val) { return PutString(out, val.data(), val.size()); }
+    static char* Put(char* out, const void* val) { return PutRaw<const void*>(out, POINTER, val); }
+
+    template<typename T>
+    static bool GetRaw(const char*& pos, const char* end, T& val)
+    {
+        if( sizeof(val) > static_cast<size_t>(end - pos) )
+            return false;
+
+        memcpy(&val, pos, sizeof(val));
+        pos += sizeof(val);
+        return true;
+    }
+
+    static void AppendInteger(int64_t val, LogBuffer& out)
+    {
+        if( val < 0 ){
+            out.Append('-');
+            out.AppendUnsigned(0 - static_cast<uint64_t>(val));
+        }else{
+            out.AppendUnsigned(val);
+        }
+    }
+
+    // a bad argument ends the substitution.
+    static const char* RenderOne(const char* pos, const char* end, LogBuffer& out)
+    {
+        Value value;
+        if( !Read(pos, end, value) )
+            return end;
+
+        RenderValue(value, out);
+        return pos;
+    }
+
+private:
+    uint32_t _size{0};
+    char _inline[INLINE_SIZE];
+    std::string _spill;
+};
+
+class SharedEvent;
+
+class LogEvent
+{
+public:
+    LogEvent() = default;
+    LogEvent(int thread_id, const char* module, const Level log_level, const char* log_text)
+        : _thread_id(thread_id), _module(module), _level(log_level), _text(log_text)
+    {
+        gettimeofday(&_timestamp, NULL);
+    }
+
+    /**
+     * deferred event: format is only read when the writer thread renders
+     * the text, see LogFormat.
+     */
+    template<typename Arg, typename... Args>
+    LogEvent(int thread_id, const char* module, const Level log_level, const LogFormat& format, const Arg& arg, const Args&... args)
+        : _thread_id(thread_id), _module(module), _level(log_level), _format(format.Str())
+    {
+        gettimeofday(&_timestamp, NULL);
+        _args.Encode(arg, args...);
+    }
+
+    // handle queued in place of an event shared by several appenders.
+    explicit LogEvent(const std::shared_ptr<SharedEvent>& shared);
+
+    LogEvent(const LogEvent& other) = default;
+    LogEvent& operator= (const LogEvent& other) = default;
+    LogEvent(LogEvent&& other) = default;
+    LogEvent& operator= (LogEvent&& other) = default;
+
+    const int ThreadID() const { return _thread_id;}
+    const char* Module() const { return _module;}
+    const timeval& Timestamp() const { return _timestamp;}
+    const Level& LogLevel() const { return _level;}
+    const std::string& Text() const { return _text;}
+
+    bool Deferred() const { return _format != nullptr; }
+    const char* FormatString() const { return _format; }
+    const LogArgs& Args() const { return _args; }
+
+    void SetThreadTag(const std::shared_ptr<const ThreadTag>& tag) { _thread_tag = tag; }
+
+    // for events decoded from a binary log.
+    void SetTimestamp(const timeval& timestamp) { _timestamp = timestamp; }
+    void SetDeferred(const char* format, LogArgs&& args) { _format = format; _args = std::move(args); }
+
+    // typed key/value fields: a STRING key then the value, per field.
+    void SetFields(LogArgs&& fields) { _fields = std::move(fields); }
+    const LogArgs& Fields() const { return _fields; }
+    const std::shared_ptr<SharedEvent>& Shared() const { return _shared; }
+    const std::string& ThreadName() const { return _thread_tag ? _thread_tag->name : EmptyString(); }
+    const std::string& Context() const { return _thread_tag ? _thread_tag->context : EmptyString(); }
+
+    // append the message text, rendering deferred arguments if needed.
+    void RenderText(LogBuffer& out) const
+    {
+        if( Deferred() )
+            _args.Render(_format, out);
+        else
+            out.Append(_text);
+    }
+    void RenderText(std::string& out) const
+    {
+        LogBuffer buffer;
+        RenderText(buffer);
+        out.append(buffer.Data(), buffer.Size());
+    }
+
+private:
+    int _thread_id{0};
+    const char* _module{""};
+    Level _level{Level::ALL};
+    std::string _text;
+
+    const char* _format{nullptr};
+    LogArgs _args;
+    LogArgs _fields;
+    std::shared_ptr<const ThreadTag> _thread_tag;
+    std::shared_ptr<SharedEvent> _shared;
+
+    struct timeval _timestamp{0, 0};
+
+    static const std::string& EmptyString()
+    {
+        static const std::string _empty;
+        return _empty;
+    }
+};
+
+/**
+ * one event fanned out to several appenders.
+ *
+ * the queues hold handles to it instead of a copy each, and the first
+ * writer formatting it leaves the line in a slot for the writers using
+ * the same formatter; a writer finding no slot just formats it again.
+ */
+class SharedEvent
+{
+    static const int SLOT_COUNT = 4;
+    // how long a writer waits for the line another writer claimed.
+    static const int WAIT_US = 1000;
+    enum { EMPTY, READY };
+
+    struct Slot
+    {
+        std::atomic<uint64_t> formatter{0};
+        std::atomic<int> state{EMPTY};
+        LogBuffer line;
+    };
+
+public:
+    explicit SharedEvent(LogEvent&& e) : _event(std::move(e))
+    {
+    }
+
+    const LogEvent& Event() const { return _event; }
+
+    /**
+     * the line of the formatter once the writer that claimed it has
+     * published it. nullptr if nobody claimed it or it takes longer than
+     * WAIT_US, the caller formats the line itself then.
+     */
+    const LogBuffer* Wait(uint64_t formatter_id) const
+    {
+        int wait_us = WAIT_US;
+        std::chrono::steady_clock::time_point deadline;
+        for(int spin = 0; ; spin++){
+            for(const Slot& slot : _slots){
+                if( slot.formatter.load(std::memory_order_relaxed) != formatter_id )
+                    continue;
+                if( slot.state.load(std::memory_order_acquire) == READY )
+                    return &slot.line;
+                break;
+            }
+
+            if( spin == 0 )
+                deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(wait_us);
+            else if( std::chrono::steady_clock::now() >= deadline )
+                return nullptr;
+            sched_yield();
+        }
+    }
+
+    /**
+     * a buffer to leave the line of the formatter in, then Publish() it.
+     * nullptr if another writer took it (Wait() for it) or no slot is free.
+     */
+    LogBuffer* Claim(uint64_t formatter_id)
+    {
+        for(Slot& slot : _slots){
+            uint64_t expected = 0;
+            if( slot.formatter.compare_exchange_strong(expected, formatter_id, std::memory_order_relaxed) )
+                return &slot.line;
+            if( expected == formatter_id )
+                return nullptr;
+        }
+        return nullptr;
+    }
+
+    void Publish(LogBuffer* line)
+    {
+        for(Slot& slot : _slots){
+            if( &slot.line == line )
+                slot.state.store(READY, std::memory_order_release);
+        }
+    }
+
+private:
+    LogEvent _event;
+    Slot _slots[SLOT_COUNT];
+};
+
+inline LogEvent::LogEvent(const std::shared_ptr<SharedEvent>& shared)
+    : _module(shared->Event().Module()), _level(shared->Event().LogLevel()), _shared(shared)
+{
+}
+
+/**
+ * log global Configure
+ * 
+ * config param:
+ * 1: lowset level
+ * 2: back up log file count
+ * 3: max log file size unit MB.
+ * 4: appender queue capacity and overflow policy, defaults for
+ *    appenders created afterwards.
+ * 5: gzip rotated files in the background, needs LOG4CPP_WITH_ZLIB.
+ * 
+ * NOTE:
+ * Set configure on first.
+ * 
+ */
+class Configure
+{
+    Configure()
+    {
+        _work_dir = Utility::CurrentWorkDirectory();
+    }
+
+public:
+    Configure(const Configure&) = delete;
+    Configure& operator=(const Configure&) = delete;
+
+    Configure(const Configure&&) = delete;
+    Configure& operator=(const Configure&&) = delete;
+
+    static Configure& Instance()
+    {
+        static Configure _instance;
+        return _instance;
+    }
+
+    /**
+     * set dir for saving files, should be end with "/".
+     * 
+     * NOTE:
+     * use local path if not set this.
+     */
+    void SetDirectory(const char* dir) { _work_dir.assign(dir); }
+    const char* GetDirectory() const { return _work_dir.c_str(); }
+
+    // also refreshes the effective level of every registered logger.
+    void SetLowestLevel(const Level& level);
+    Level GetLowestLevel() const { return _lowest_level.load(std::memory_order_relaxed); }
+
+    void SetBackupCount(unsigned int count) { _log_back_count.store(count, std::memory_order_relaxed); }
+    unsigned int GetBackupCount() const { return _log_back_count.load(std::memory_order_relaxed); }
+
+    // unit:MB.
+    void SetLogFileMaxSize(unsigned int size)
+    { 
+        if( size == 0 || size > 10 * 1024)
+            throw std::invalid_argument("valid range: (0M, 10G].");
+
+        _file_max_size.store(size, std::memory_order_relaxed);
+    }
+    unsigned int GetLogFileMaxSize() const { return _file_max_size.load(std::memory_order_relaxed); }
+
+    // events, rounded up to a power of 2.
+    void SetQueueCapacity(size_t capacity)
+    {
+        if( capacity == 0 || capacity > MAX_QUEUE_CAPACITY )
+            throw std::invalid_argument("valid range: (0, 1M] events.");
+
+        _queue_capacity.store(capacity, std::memory_order_relaxed);
+    }
+    size_t GetQueueCapacity() const { return _queue_capacity.load(std::memory_order_relaxed); }
+
+    /**
+     * level only matters for DROP_BELOW_LEVEL: events below it are
+     * dropped when the queue is full.
+     */
+    void SetOverflowPolicy(OverflowPolicy policy, const Level& level = Level::WARN)
+    {
+        _overflow_policy.store(policy, std::memory_order_relaxed);
+        _overflow_level.store(level, std::memory_order_relaxed);
+    }
+    OverflowPolicy GetOverflowPolicy() const { return _overflow_policy.load(std::memory_order_relaxed); }
+    Level GetOverflowLevel() const { return _overflow_level.load(std::memory_order_relaxed); }
+
+    static const size_t MAX_QUEUE_CAPACITY = 1024 * 1024;
+
+    /**
+     * compress rotated files to file.1.gz ... file.N.gz on a background
+     * thread, N still being the backup count.
+     *
+     * NOTE:
+     * only built with LOG4CPP_WITH_ZLIB (and -lz), throw otherwise.
+     */
+    void SetBackupCompress(bool compress)
+    {
+#ifndef LOG4CPP_WITH_ZLIB
+        if( compress )
+            throw std::invalid_argument("built without zlib, define LOG4CPP_WITH_ZLIB.");
+#endif
+        _backup_compress.store(compress, std::memory_order_relaxed);
+    }
+    bool GetBackupCompress() const { return _backup_compress.load(std::memory_order_relaxed); }
+
+private:
+    std::string _work_dir;
+
+    // atomics, a ConfigWatcher may change them while appenders run.
+    std::atomic<Level> _lowest_level{Level::ALL};
+    std::atomic<unsigned int> _log_back_count{0};
+    std::atomic<unsigned int> _file_max_size{3}; // MB
+
+    std::atomic<size_t> _queue_capacity{4096};
+    std::atomic<OverflowPolicy> _overflow_policy{OverflowPolicy::BLOCK};
+    std::atomic<Level> _overflow_level{Level::WARN};
+
+    std::atomic<bool> _backup_compress{false};
+};
+
+/**
+ * per-thread cache of the rendered "%Y%m%d-%H:%M:%S" of the current second.
+ *
+ * localtime_r and strftime only run when the second rolls over or the
+ * timezone is invalidated, every other event just patches the
+ * milliseconds. tzset() is re-run on each new minute so changes of TZ or
+ * /etc/localtime are picked up without an explicit invalidation.
+ */
+class TimestampCache
+{
+    TimestampCache();
+
+    struct Entry
+    {
+        time_t second{-1};
+        time_t minute{-1};
+        unsigned int generation{0};
+        size_t length{0};
+        char prefix[32];
+        struct tm local;
+    };
+
+public:
+    static const size_t MAX_LENGTH = 32;
+
+    // drop every thread's cached second, e.g. after changing TZ.
+    static void InvalidateTimezone()
+    {
+        Generation().fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * write "%Y%m%d-%H:%M:%S.mmm" to out (at least MAX_LENGTH bytes),
+     * return the length, out is not '\0' terminated.
+     */
+    static size_t Render(const timeval& tv, char* out)
+    {
+        const Entry& entry = Refresh(tv.tv_sec);
+        memcpy(out, entry.prefix, entry.length);
+
+        int millisecond = (int)(tv.tv_usec / 1000);
+        char* pos = out + entry.length;
+        pos[0] = '.';
+        pos[1] = '0' + millisecond / 100;
+        pos[2] = '0' + millisecond / 10 % 10;
+        pos[3] = '0' + millisecond % 10;
+
+        return entry.length + 4;
+    }
+
+    static unsigned int TimezoneGeneration()
+    {
+        return Generation().load(std::memory_order_acquire);
+    }
+
+    // broken down local time of the second, cached like Render's prefix.
+    static const struct tm& LocalTime(time_t second)
+    {
+        return Refresh(second).local;
+    }
+
+private:
+    static const Entry& Refresh(time_t second)
+    {
+        Entry& entry = Local();
+
+        unsigned int generation = Generation().load(std::memory_order_acquire);
+        if( second != entry.second || generation != entry.generation ){
+            time_t minute = second / 60;
+            if( minute != entry.minute || generation != entry.generation ){
+                tzset();
+                entry.minute = minute;
+            }
+
+            localtime_r(&second, &entry.local);
+
+            entry.length = strftime(entry.prefix, sizeof(entry.prefix), "%Y%m%d-%H:%M:%S", &entry.local);
+            entry.second = second;
+            entry.generation = generation;
+        }
+
+        return entry;
+    }
+
+    static Entry& Local()
+    {
+        static thread_local Entry _entry;
+        return _entry;
+    }
+
+    static std::atomic<unsigned int>& Generation()
+    {
+        static std::atomic<unsigned int> _generation{0};
+        return _generation;
+    }
+};
+
+/**
+ * turns an event into one line of text.
+ *
+ * appenders call FormatInto, which appends the line to the writer's
+ * reusable buffer and so doesn't allocate once that buffer has grown.
+ * formatters written against FormatHeader keep working unchanged: the
+ * default FormatInto appends its header and the text, paying for the
+ * header string. new formatters should override FormatInto instead.
+ */
+class Formatter
+{
+protected:
+    virtual ~Formatter() {};
+
+public:
+    // unique per formatter, never reused.
+    uint64_t ID() const { return _formatter_id; }
+
+    std::string Format(const LogEvent& e)
+    {
+        LogBuffer buffer;
+        FormatInto(e, buffer);
+
+        return std::string(buffer.Data(), buffer.Size());
+    }
+
+    virtual void FormatInto(const LogEvent& e, LogBuffer& out)
+    {
+        out.Append(FormatHeader(e));
+        e.RenderText(out);
+    }
+
+protected:
+    // only used by the default FormatInto.
+    virtual std::string FormatHeader(const LogEvent& e)
+    {
+        return "";
+    }
+
+    std::string FormatTimestamp(const timeval& tv)
+    {
+        char time_str[TimestampCache::MAX_LENGTH];
+        size_t len = TimestampCache::Render(tv, time_str);
+
+        return std::string(time_str, len);
+    }
+
+    const char* FormatLevel(Level level) const
+    {
+        switch(level)
+        {
+        case Level::DEBUG: return "[DEBUG]";
+        case Level::INFO:  return "[INFO] ";
+        case Level::WARN:  return "[WARN] ";
+        case Level::ERROR: return "[ERROR]";
+        case Level::FATAL: return "[FATAL]";
+        default: 
+            return "[UNKNOWN]";
+        }
+
+        return "";
+    }
+
+    // bare level name, e.g. "INFO".
+    static const char* LevelName(Level level)
+    {
+        switch(level)
+        {
+        case Level::DEBUG: return "DEBUG";
+        case Level::INFO:  return "INFO";
+        case Level::WARN:  return "WARN";
+        case Level::ERROR: return "ERROR";
+        case Level::FATAL: return "FATAL";
+        default:
+            return "UNKNOWN";
+        }
+    }
+
+    void AppendTimestamp(const timeval& tv, LogBuffer& out)
+    {
+        char time_str[TimestampCache::MAX_LENGTH];
+        out.Append(time_str, TimestampCache::Render(tv, time_str));
+    }
+
+    // thread id, then "|name" for named threads.
+    void AppendThread(const LogEvent& e, LogBuffer& out)
+    {
+        out.AppendUnsigned(static_cast<unsigned int>(e.ThreadID()));
+        if( !e.ThreadName().empty() ){
+            out.Append('|');
+            out.Append(e.ThreadName());
+        }
+    }
+
+    // " key=value ..." after the text, nothing without fields.
+    void AppendFields(const LogEvent& e, LogBuffer& out)
+    {
+        LogArgs::Value value;
+        const char* pos = e.Fields().Data();
+        const char* end = e.Fields().End();
+        while( pos < end ){
+            out.Append(' ');
+            if( !LogArgs::Read(pos, end, value) )
+                break;
+            LogArgs::RenderValue(value, out);
+            out.Append('=');
+            if( !LogArgs::Read(pos, end, value) )
+                break;
+            LogArgs::RenderValue(value, out);
+        }
+    }
+
+    // "{key=value ...} " before the text, nothing without context.
+    void AppendContext(const LogEvent& e, LogBuffer& out)
+    {
+        if( e.Context().empty() )
+            return;
+
+        out.Append('{');
+        out.Append(e.Context());
+        out.Append("} ", 2);
+    }
+
+private:
+    // ids, unlike addresses, are never reused by a later formatter.
+    static uint64_t NextID()
+    {
+        static std::atomic<uint64_t> _next{1};
+        return _next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    const uint64_t _formatter_id{NextID()};
+};
+
+class ConsoleFormatter
+    : public Formatter
+    , public std::enable_shared_from_this<ConsoleFormatter>
+{
+public:
+    ~ConsoleFormatter() {}
+
+public:
+    void FormatInto(const LogEvent& e, LogBuffer& out) override
+    {
+        out.Append('[');
+        AppendTimestamp(e.Timestamp(), out);
+        out.Append("] [", 3);
+        AppendThread(e, out);
+        out.Append("] [", 3);
+        out.Append(e.Module());
+        out.Append("] ", 2);
+        out.Append(FormatLevel(e.LogLevel()));
+        out.Append(' ');
+        AppendContext(e, out);
+        e.RenderText(out);
+        AppendFields(e, out);
+    }
+};
+
+class FileFormatter
+    : public Formatter
+    , public std::enable_shared_from_this<FileFormatter>
+{
+public:
+    void FormatInto(const LogEvent& e, LogBuffer& out) override
+    {
+        out.Append('[');
+        AppendTimestamp(e.Timestamp(), out);
+        out.Append("] [", 3);
+        AppendThread(e, out);
+        out.Append("] ", 2);
+        out.Append(FormatLevel(e.LogLevel()));
+        out.Append(' ');
+        AppendContext(e, out);
+        e.RenderText(out);
+        AppendFields(e, out);
+    }
+};
+
+/**
+ * formatter laid out by a log4j style pattern, e.g.
+ * "%d{%H:%M:%S.%e} [%t] %c %p %m".
+ *
+ * conversions:
+ *   %d{fmt}  timestamp, fmt takes strftime fields plus %e (milliseconds)
+ *            and %f (microseconds); plain %d is "%Y%m%d-%H:%M:%S.%e".
+ *   %t       thread id             %T  thread name, or the id if unnamed
+ *   %c       logger name           %p  level, e.g. "INFO"
+ *   %m       message text          %X  thread context "key=value ..."
+ *   %%       a literal '%'
+ *
+ * the pattern is compiled once into a flat op list with the literal runs
+ * kept in one string. the strftime part of a date between sub-second
+ * fields is rendered once per second and thread, like TimestampCache, so
+ * rendering is a switch per op. an invalid pattern throws
+ * std::invalid_argument.
+ */
+class PatternFormatter
+    : public Formatter
+    , public std::enable_shared_from_this<PatternFormatter>
+{
+    enum class Code : uint8_t
+    {
+        LITERAL,        // _literals[offset, offset + length)
+        DATE,           // strftime format at _literals + offset.
+        MILLISECOND,    // %e
+        MICROSECOND,    // %f
+        THREAD_ID,
+        THREAD_NAME,
+        MODULE,
+        LEVEL,
+        MESSAGE,
+        CONTEXT
+    };
+
+    struct Op
+    {
+        Code code;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // per-thread rendered DATE op of the current second.
+    struct DateEntry
+    {
+        uint64_t formatter{0};
+        uint32_t offset{0};
+        time_t second{-1};
+        unsigned int generation{0};
+        size_t length{0};
+        char text[64];
+    };
+    static const size_t DATE_CACHE_SIZE = 8;
+
+public:
+    explicit PatternFormatter(const std::string& pattern)
+        : _pattern(pattern)
+    {
+        Compile();
+    }
+
+    const std::string& Pattern() const { return _pattern; }
+
+    void FormatInto(const LogEvent& e, LogBuffer& out) override
+    {
+        for(const Op& op : _ops){
+            switch(op.code)
+            {
+            case Code::LITERAL: out.Append(_literals.data() + op.offset, op.length); break;
+            case Code::DATE: AppendDate(op, e.Timestamp().tv_sec, out); break;
+            case Code::MILLISECOND: AppendDigits(out, e.Timestamp().tv_usec / 1000, 3); break;
+            case Code::MICROSECOND: AppendDigits(out, e.Timestamp().tv_usec, 6); break;
+            case Code::THREAD_ID: out.AppendUnsigned(static_cast<unsigned int>(e.ThreadID())); break;
+            case Code::THREAD_NAME:
+                if( e.ThreadName().empty() )
+                    out.AppendUnsigned(static_cast<unsigned int>(e.ThreadID()));
+                else
+                    out.Append(e.ThreadName());
+                break;
+            case Code::MODULE: out.Append(e.Module()); break;
+            case Code::LEVEL: out.Append(LevelName(e.LogLevel())); break;
+            case Code::MESSAGE: e.RenderText(out); break;
+            case Code::CONTEXT: out.Append(e.Context()); break;
+            }
+        }
+    }
+
+private:
+    void Compile()
+    {
+        const char* pos = _pattern.c_str();
+        while( *pos != '\0' ){
+            if( *pos != '%' ){
+                AddLiteral(pos, 1);
+                pos++;
+                continue;
+            }
+
+            char conversion = pos[1];
+            pos += conversion == '\0' ? 1 : 2;
+            switch(conversion)
+            {
+            case '%': AddLiteral("%", 1); break;
+            case 'd':
+            {
+                if( *pos != '{' ){
+                    CompileDate("%Y%m%d-%H:%M:%S.%e");
+                    break;
+                }
+
+                const char* end = strchr(pos, '}');
+                if( end == nullptr )
+                    throw std::invalid_argument("unterminated %d{ in pattern: " + _pattern);
+
+                CompileDate(std::string(pos + 1, end));
+                pos = end + 1;
+                break;
+            }
+            case 't': AddOp(Code::THREAD_ID); break;
+            case 'T': AddOp(Code::THREAD_NAME); break;
+            case 'c': AddOp(Code::MODULE); break;
+            case 'p': AddOp(Code::LEVEL); break;
+            case 'm': AddOp(Code::MESSAGE); break;
+            case 'X': AddOp(Code::CONTEXT); break;
+            default:
+                throw std::invalid_argument("unknown conversion in pattern: " + _pattern);
+            }
+        }
+    }
+
+    // strftime runs become DATE ops, split at the sub-second fields.
+    void CompileDate(const std::string& date)
+    {
+        std::string run;
+        for(size_t index = 0; index < date.size(); index++){
+            if( date[index] != '%' ){
+                run.push_back(date[index]);
+                continue;
+            }
+            if( index + 1 == date.size() )
+                throw std::invalid_argument("dangling % in date of pattern: " + _pattern);
+
+            char field = date[++index];
+            if( field == 'e' || field == 'f' ){
+                AddDate(run);
+                run.clear();
+                AddOp(field == 'e' ? Code::MILLISECOND : Code::MICROSECOND);
+            }else{
+                run.push_back('%');
+                run.push_back(field);
+            }
+        }
+
+        AddDate(run);
+    }
+
+    void AddDate(const std::string& format)
+    {
+        if( format.empty() )
+            return;
+
+        // '\0' terminated for strftime.
+        _ops.push_back(Op{Code::DATE, static_cast<uint32_t>(_literals.size()), static_cast<uint32_t>(format.size())});
+        _literals.append(format).append(1, '\0');
+    }
+
+    // adjacent literals are merged into one op.
+    void AddLiteral(const char* text, size_t len)
+    {
+        if( _ops.empty() || _ops.back().code != Code::LITERAL
+            || _ops.back().offset + _ops.back().length != _literals.size() ){
+            _ops.push_back(Op{Code::LITERAL, static_cast<uint32_t>(_literals.size()), 0});
+        }
+
+        _literals.append(text, len);
+        _ops.back().length += len;
+    }
+
+    void AddOp(Code code)
+    {
+        _ops.push_back(Op{code, 0, 0});
+    }
+
+    void AppendDate(const Op& op, time_t second, LogBuffer& out)
+    {
+        static thread_local DateEntry _entries[DATE_CACHE_SIZE];
+        DateEntry& entry = _entries[(ID() * 31 + op.offset) % DATE_CACHE_SIZE];
+
+        unsigned int generation = TimestampCache::TimezoneGeneration();
+        if( entry.formatter != ID() || entry.offset != op.offset
+            || entry.second != second || entry.generation != generation ){
+            const struct tm& local = TimestampCache::LocalTime(second);
+            entry.length = strftime(entry.text, sizeof(entry.text), _literals.c_str() + op.offset, &local);
+            entry.formatter = ID();
+            entry.offset = op.offset;
+            entry.second = second;
+            entry.generation = generation;
+        }
+
+        out.Append(entry.text, entry.length);
+    }
+
+    // value zero padded to width digits.
+    static void AppendDigits(LogBuffer& out, unsigned long value, int width)
+    {
+        char digits[8];
+        for(int index = width - 1; index >= 0; index--){
+            digits[index] = '0' + value % 10;
+            value /= 10;
+        }
+
+        out.Append(digits, width);
+    }
+
+private:
+    std::string _pattern;
+    std::string _literals;
+    std::vector<Op> _ops;
+};
+
+/**
+ * one JSON object per line, written straight into the buffer:
+ * {"ts":"2024-01-02T03:04:05.678+0800","level":"INFO","logger":"mod",
+ *  "tid":123,"thread":"name","ctx":"k=v","msg":"text","key":value,...}
+ *
+ * "thread" and "ctx" are only present when set, Kv fields follow "msg"
+ * with numbers and booleans unquoted. strings are escaped by Escape().
+ */
+class JsonFormatter
+    : public Formatter
+    , public std::enable_shared_from_this<JsonFormatter>
+{
+public:
+    void FormatInto(const LogEvent& e, LogBuffer& out) override
+    {
+        out.Append("{\"ts\":\"", 7);
+        AppendIsoTimestamp(e.Timestamp(), out);
+        out.Append("\",\"level\":\"", 11);
+        out.Append(LevelName(e.LogLevel()));
+        out.Append("\",\"logger\":\"", 12);
+        Escape(e.Module(), strlen(e.Module()), out);
+        out.Append("\",\"tid\":", 8);
+        out.AppendUnsigned(static_cast<unsigned int>(e.ThreadID()));
+        if( !e.ThreadName().empty() ){
+            out.Append(",\"thread\":\"", 11);
+            Escape(e.ThreadName().data(), e.ThreadName().size(), out);
+            out.Append('"');
+        }
+        if( !e.Context().empty() ){
+            out.Append(",\"ctx\":\"", 8);
+            Escape(e.Context().data(), e.Context().size(), out);
+            out.Append('"');
+        }
+
+        // the text is rendered aside, then escaped in one pass.
+        static thread_local LogBuffer _text;
+        _text.Clear();
+        e.RenderText(_text);
+        out.Append(",\"msg\":\"", 8);
+        Escape(_text.Data(), _text.Size(), out);
+        out.Append('"');
+
+        LogArgs::Value key, value;
+        const char* pos = e.Fields().Data();
+        const char* end = e.Fields().End();
+        while( pos < end ){
+            if( !LogArgs::Read(pos, end, key) || !LogArgs::Read(pos, end, value) )
+                break;
+
+            out.Append(",\"", 2);
+            AppendString(key, out);
+            out.Append("\":", 2);
+            AppendValue(value, out);
+        }
+
+        out.Append('}');
+    }
+
+    /**
+     * append data as the inside of a JSON string: '"', '\\' and control
+     * characters are escaped, everything else, UTF-8 included, is copied.
+     * SSE2 checks 16 bytes at a time, so clean runs cost about a memcpy.
+     */
+    static void Escape(const char* data, size_t len, LogBuffer& out)
+    {
+        const char* end = data + len;
+        const char* run = data;
+        const char* pos = data;
+        while( pos < end ){
+#ifdef __SSE2__
+            // 64 clean bytes per branch, then 16 to find the first special.
+            while( end - pos >= 64 ){
+                __m128i special = _mm_or_si128(
+                    _mm_or_si128(Special(pos), Special(pos + 16)),
+                    _mm_or_si128(Special(pos + 32), Special(pos + 48)));
+                if( _mm_movemask_epi8(special) != 0 )
+                    break;
+                pos += 64;
+            }
+            while( end - pos >= 16 ){
+                int mask = _mm_movemask_epi8(Special(pos));
+                if( mask != 0 ){
+                    pos += __builtin_ctz(mask);
+                    break;
+                }
+                pos += 16;
+            }
+#endif
+            while( pos < end && !NeedsEscape(*pos) )
+                pos++;
+            if( pos == end )
+                break;
+
+            out.Append(run, pos - run);
+            AppendEscaped(*pos, out);
+            run = ++pos;
+        }
+
+        out.Append(run, end - run);
+    }
+
+private:
+#ifdef __SSE2__
+    // 0xFF for each of the 16 bytes at pos that needs escaping.
+    static __m128i Special(const char* pos)
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        return _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+    }
+#endif
+
+    static bool NeedsEscape(char c)
+    {
+        return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+    }
+
+    static void AppendEscaped(char c, LogBuffer& out)
+    {
+        switch(c)
+        {
+        case '"': out.Append("\\\"", 2); break;
+        case '\\': out.Append("\\\\", 2); break;
+        case '\n': out.Append("\\n", 2); break;
+        case '\r': out.Append("\\r", 2); break;
+        case '\t': out.Append("\\t", 2); break;
+        case '\b': out.Append("\\b", 2); break;
+        case '\f': out.Append("\\f", 2); break;
+        default:
+        {
+            static const char* HEX = "0123456789abcdef";
+            char unicode[6] = {'\\', 'u', '0', '0', HEX[(c >> 4) & 0xF], HEX[c & 0xF]};
+            out.Append(unicode, sizeof(unicode));
+            break;
+        }
+        }
+    }
+
+    // a field key is always a STRING.
+    static void AppendString(const LogArgs::Value& value, LogBuffer& out)
+    {
+        Escape(value.str, value.len, out);
+    }
+
+    static void AppendValue(const LogArgs::Value& value, LogBuffer& out)
+    {
+        char buffer[64];
+        int len = 0;
+
+        switch(value.type)
+        {
+        case LogArgs::BOOL:
+        case LogArgs::INT32:
+        case LogArgs::UINT32:
+        case LogArgs::INT64:
+        case LogArgs::UINT64:
+            LogArgs::RenderValue(value, out);
+            return;
+        case LogArgs::FLOAT: len = FiniteNumber(value.f, "%.9g", buffer, sizeof(buffer)); break;
+        case LogArgs::DOUBLE: len = FiniteNumber(value.d, "%.17g", buffer, sizeof(buffer)); break;
+        case LogArgs::LONG_DOUBLE: len = FiniteNumber(static_cast<double>(value.ld), "%.17g", buffer, sizeof(buffer)); break;
+        case LogArgs::CHAR:
+        case LogArgs::STRING:
+        case LogArgs::POINTER:
+        {
+            static thread_local LogBuffer _scratch;
+            _scratch.Clear();
+            LogArgs::RenderValue(value, _scratch);
+
+            out.Append('"');
+            Escape(_scratch.Data(), _scratch.Size(), out);
+            out.Append('"');
+            return;
+        }
+        }
+
+        out.Append(buffer, std::min<size_t>(len, sizeof(buffer) - 1));
+    }
+
+    // JSON has no NaN or infinity, they become null.
+    static int FiniteNumber(double val, const char* format, char* buffer, size_t size)
+    {
+        if( val != val || val - val != 0 )
+            return snprintf(buffer, size, "null");
+
+        return snprintf(buffer, size, format, val);
+    }
+
+    // "2024-01-02T03:04:05.678+0800"
+    static void AppendIsoTimestamp(const timeval& tv, LogBuffer& out)
+    {
+        const struct tm& local = TimestampCache::LocalTime(tv.tv_sec);
+
+        long offset = local.tm_gmtoff / 60;
+        char sign = offset < 0 ? '-' : '+';
+        offset = offset < 0 ? -offset : offset;
+
+        char text[32];
+        int pos = 0;
+        pos = PutDigits(text, pos, local.tm_year + 1900, 4);
+        text[pos++] = '-';
+        pos = PutDigits(text, pos, local.tm_mon + 1, 2);
+        text[pos++] = '-';
+        pos = PutDigits(text, pos, local.tm_mday, 2);
+        text[pos++] = 'T';
+        pos = PutDigits(text, pos, local.tm_hour, 2);
+        text[pos++] = ':';
+        pos = PutDigits(text, pos, local.tm_min, 2);
+        text[pos++] = ':';
+        pos = PutDigits(text, pos, local.tm_sec, 2);
+        text[pos++] = '.';
+        pos = PutDigits(text, pos, tv.tv_usec / 1000, 3);
+        text[pos++] = sign;
+        pos = PutDigits(text, pos, offset / 60, 2);
+        pos = PutDigits(text, pos, offset % 60, 2);
+
+        out.Append(text, pos);
+    }
+
+    static int PutDigits(char* text, int pos, long value, int width)
+    {
+        for(int index = width - 1; index >= 0; index--){
+            text[pos + index] = '0' + value % 10;
+            value /= 10;
+        }
+
+        return pos + width;
+    }
+};
+
+/**
+ * bounded multi-producer/single-consumer ring buffer.
+ *
+ * every slot carries a sequence number: a producer claims a slot with one
+ * CAS on the enqueue position and publishes it by bumping the slot
+ * sequence, the consumer does the same on the dequeue side. since that
+ * side is CAS based too, a producer may also pop, e.g. to evict the
+ * oldest event. positions
+ * are padded onto their own cache lines so producers and consumer don't
+ * share one.
+ *
+ * capacity is rounded up to a power of 2.
+ */
+template<typename T>
+class RingQueue
+{
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    struct alignas(CACHE_LINE_SIZE) Slot
+    {
+        std::atomic<size_t> _sequence;
+        T _data;
+    };
+
+public:
+    explicit RingQueue(size_t capacity)
+    {
+        _capacity = 2;
+        while( _capacity < capacity ) _capacity <<= 1;
+        _mask = _capacity - 1;
+
+        void* mem = nullptr;
+        if( posix_memalign(&mem, CACHE_LINE_SIZE, sizeof(Slot) * _capacity) != 0 )
+            throw std::bad_alloc();
+
+        _slots = static_cast<Slot*>(mem);
+        for(size_t index = 0; index < _capacity; index++){
+            new (&_slots[index]) Slot();
+            _slots[index]._sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+    ~RingQueue()
+    {
+        for(size_t index = 0; index < _capacity; index++)
+            _slots[index].~Slot();
+
+        free(_slots);
+    }
+
+    RingQueue(const RingQueue&) = delete;
+    RingQueue& operator=(const RingQueue&) = delete;
+
+    /**
+     * data is only moved from when the push succeeds.
+     * return false if the queue is full.
+     */
+    bool TryPush(T&& data)
+    {
+        size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        for(;;){
+            Slot& slot = _slots[pos & _mask];
+            size_t seq = slot._sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if( diff == 0 ){
+                if( _enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ){
+                    slot._data = std::move(data);
+                    slot._sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }else if( diff < 0 ){
+                return false;
+            }else{
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& data)
+    {
+        size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        for(;;){
+            Slot& slot = _slots[pos & _mask];
+            size_t seq = slot._sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if( diff == 0 ){
+                if( _dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ){
+                    data = std::move(slot._data);
+                    slot._sequence.store(pos + _capacity, std::memory_order_release);
+                    return true;
+                }
+            }else if( diff < 0 ){
+                return false;
+            }else{
+                pos = _dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool Empty() const
+    {
+        size_t pos = _dequeue_pos.load(std::memory_order_acquire);
+        return _slots[pos & _mask]._sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    // approximate, only exact when no one is pushing or popping.
+    size_t Size() const
+    {
+        size_t tail = _dequeue_pos.load(std::memory_order_relaxed);
+        size_t head = _enqueue_pos.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    size_t Capacity() const { return _capacity; }
+
+private:
+    Slot* _slots{nullptr};
+    size_t _capacity{0};
+    size_t _mask{0};
+
+    // padding instead of alignas keeps the owner free of extended alignment.
+    char _pad0[CACHE_LINE_SIZE];
+    std::atomic<size_t> _enqueue_pos{0};
+    char _pad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _dequeue_pos{0};
+    char _pad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+/**
+ * formatted records drained in one go by an appender's writer thread.
+ *
+ * records are stored back to back in one buffer, each one followed by
+ * '\n', so the whole batch can be written with a single call.
+ */
+class LogBatch
+{
+public:
+    void Add(const std::string& record)
+    {
+        BeginRecord().Append(record);
+        EndRecord();
+    }
+
+    // the record is appended to the returned buffer, then EndRecord().
+    LogBuffer& BeginRecord()
+    {
+        return _buffer;
+    }
+    // binary records go without the '\n', Record() is then meaningless.
+    void EndRecord(bool newline = true)
+    {
+        if( newline )
+            _buffer.Append('\n');
+        _record_ends.push_back(_buffer.Size());
+    }
+
+    // record text without the trailing '\n'.
+    std::string Record(size_t index) const
+    {
+        size_t begin = index == 0 ? 0 : _record_ends[index - 1];
+        return std::string(_buffer.Data() + begin, _record_ends[index] - begin - 1);
+    }
+
+    // offset just past the record's '\n'.
+    size_t RecordEnd(size_t index) const { return _record_ends[index]; }
+
+    size_t Count() const { return _record_ends.size(); }
+    bool Empty() const { return _record_ends.empty(); }
+
+    const char* Data() const { return _buffer.Data(); }
+    size_t Size() const { return _buffer.Size(); }
+
+    // highest level formatted into the batch, for FlushPolicy::level.
+    void NoteLevel(const Level& level)
+    {
+        if( level > _max_level )
+            _max_level = level;
+    }
+    Level MaxLevel() const { return _max_level; }
+
+    void Clear()
+    {
+        _buffer.Clear();
+        _record_ends.clear();
+        _max_level = Level::ALL;
+    }
+
+private:
+    LogBuffer _buffer;
+    std::vector<size_t> _record_ends;
+    Level _max_level{Level::ALL};
+};
+
+/**
+ * log2 histogram of durations, bucket i counts [2^i, 2^(i+1)) ns.
+ */
+class LatencyHistogram
+{
+public:
+    static const int BUCKET_COUNT = 40;
+
+    LatencyHistogram()
+    {
+        for(int index = 0; index < BUCKET_COUNT; index++)
+            _buckets[index] = 0;
+    }
+
+    static int BucketOf(uint64_t ns)
+    {
+        int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+        return std::min(bucket, BUCKET_COUNT - 1);
+    }
+
+    void Add(int bucket, uint64_t count) { _buckets[bucket] += count; }
+    uint64_t Bucket(int bucket) const { return _buckets[bucket]; }
+
+    uint64_t Count() const
+    {
+        uint64_t count = 0;
+        for(int index = 0; index < BUCKET_COUNT; index++)
+            count += _buckets[index];
+
+        return count;
+    }
+
+    // upper bound in ns of the bucket reaching ratio of the samples.
+    uint64_t Percentile(double ratio) const
+    {
+        uint64_t count = Count();
+        if( count == 0 )
+            return 0;
+
+        uint64_t rank = static_cast<uint64_t>(ratio * count);
+        uint64_t seen = 0;
+        for(int index = 0; index < BUCKET_COUNT; index++){
+            seen += _buckets[index];
+            if( seen > rank )
+                return (2ull << index) - 1;
+        }
+
+        return (2ull << (BUCKET_COUNT - 1)) - 1;
+    }
+
+private:
+    uint64_t _buckets[BUCKET_COUNT];
+};
+
+/**
+ * snapshot of one appender's pipeline counters.
+ */
+struct AppenderMetrics
+{
+    static const int LEVEL_COUNT = static_cast<int>(Level::OFF) + 1;
+
+    std::string name;
+
+    size_t queue_capacity{0};
+    size_t queue_depth{0};
+    size_t queue_peak{0};
+
+    uint64_t enqueued{0};
+    LatencyHistogram enqueue_latency;   // sampled, see WorkMetrics.
+
+    uint64_t format_ns{0};
+    uint64_t output_ns{0};
+    uint64_t bytes{0};
+    uint64_t lines{0};
+    uint64_t rotations{0};
+    uint64_t dropped[LEVEL_COUNT] = {0};
+};
+
+/**
+ * live counters of an appender's Work queue.
+ *
+ * producer side counters are sharded by thread so producers don't share
+ * cache lines, and only one Post in SAMPLE_EVERY per thread is timed.
+ * writer side counters have a single writer, relaxed atomics only make
+ * them safe to snapshot from other threads.
+ */
+class WorkMetrics
+{
+    static const int SHARD_COUNT = 16;
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    struct Shard
+    {
+        std::atomic<uint64_t> _enqueued{0};
+        std::atomic<uint64_t> _latency[LatencyHistogram::BUCKET_COUNT];
+        char _pad[CACHE_LINE_SIZE];
+    };
+
+public:
+    static const unsigned int SAMPLE_EVERY = 16;
+
+    WorkMetrics()
+    {
+        for(auto& shard : _shards){
+            for(auto& bucket : shard._latency)
+                bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // true for the Posts whose latency gets measured.
+    static bool Sample()
+    {
+        static thread_local unsigned int _count = 0;
+        return _count++ % SAMPLE_EVERY == 0;
+    }
+
+    void Enqueued()
+    {
+        LocalShard()._enqueued.fetch_add(1, std::memory_order_relaxed);
+    }
+    void EnqueueLatency(uint64_t ns)
+    {
+        LocalShard()._latency[LatencyHistogram::BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // writer thread only.
+    void Written(size_t depth, uint64_t format_ns, uint64_t output_ns, size_t bytes, size_t lines)
+    {
+        if( depth > _queue_peak.load(std::memory_order_relaxed) )
+            _queue_peak.store(depth, std::memory_order_relaxed);
+
+        Add(_format_ns, format_ns);
+        Add(_output_ns, output_ns);
+        Add(_bytes, bytes);
+        Add(_lines, lines);
+    }
+    void Rotated()
+    {
+        _rotations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Snapshot(AppenderMetrics& metrics) const
+    {
+        for(const auto& shard : _shards){
+            metrics.enqueued += shard._enqueued.load(std::memory_order_relaxed);
+            for(int index = 0; index < LatencyHistogram::BUCKET_COUNT; index++)
+                metrics.enqueue_latency.Add(index, shard._latency[index].load(std::memory_order_relaxed));
+        }
+
+        metrics.queue_peak = std::max<size_t>(metrics.queue_depth, _queue_peak.load(std::memory_order_relaxed));
+        metrics.format_ns = _format_ns.load(std::memory_order_relaxed);
+        metrics.output_ns = _output_ns.load(std::memory_order_relaxed);
+        metrics.bytes = _bytes.load(std::memory_order_relaxed);
+        metrics.lines = _lines.load(std::memory_order_relaxed);
+        metrics.rotations = _rotations.load(std::memory_order_relaxed);
+    }
+
+private:
+    static void Add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    Shard& LocalShard()
+    {
+        static std::atomic<unsigned int> _next{0};
+        static thread_local unsigned int _index = _next.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+        return _shards[_index];
+    }
+
+private:
+    Shard _shards[SHARD_COUNT];
+
+    std::atomic<size_t> _queue_peak{0};
+    std::atomic<uint64_t> _format_ns{0};
+    std::atomic<uint64_t> _output_ns{0};
+    std::atomic<uint64_t> _bytes{0};
+    std::atomic<uint64_t> _lines{0};
+    std::atomic<uint64_t> _rotations{0};
+};
+
+/**
+ * read side of copy-on-write data.
+ *
+ * readers enter a Guard around their use of a published copy, a writer
+ * that swapped the copy out calls Synchronize() before freeing it, which
+ * returns once every reader that could still see it has left. reader
+ * counts are sharded by thread and split in two epochs, a steady stream
+ * of new readers can't hold a writer back.
+ *
+ * readers never block; writers must be serialized by the caller.
+ */
+class ReadCopyUpdate
+{
+    static const int SHARD_COUNT = 16;
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    struct Shard
+    {
+        std::atomic<int> _readers[2];
+        char _pad[CACHE_LINE_SIZE];
+    };
+
+public:
+    class Guard
+    {
+    public:
+        Guard(ReadCopyUpdate& rcu)
+            : _counter(rcu.LocalShard()._readers[rcu._epoch.load()])
+        {
+            _counter.fetch_add(1);
+        }
+        ~Guard()
+        {
+            _counter.fetch_sub(1);
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator= (const Guard&) = delete;
+
+    private:
+        std::atomic<int>& _counter;
+    };
+
+    ReadCopyUpdate()
+    {
+        for(auto& shard : _shards){
+            shard._readers[0].store(0);
+            shard._readers[1].store(0);
+        }
+    }
+
+    /**
+     * wait for the readers that entered before this call.
+     *
+     * a reader may count itself in an epoch that was just flipped away,
+     * so both epochs are drained in turn, new readers always going to
+     * the one not waited for.
+     */
+    void Synchronize()
+    {
+        for(int round = 0; round < 2; round++){
+            int epoch = _epoch.load();
+            _epoch.store(epoch ^ 1);
+
+            for(auto& shard : _shards){
+                while( shard._readers[epoch].load() != 0 )
+                    sched_yield();
+            }
+        }
+    }
+
+private:
+    Shard& LocalShard()
+    {
+        static std::atomic<unsigned int> _next{0};
+        static thread_local unsigned int _index = _next.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+        return _shards[_index];
+    }
+
+private:
+    std::atomic<int> _epoch{0};
+    Shard _shards[SHARD_COUNT];
+};
+
+/**
+ * something the writer threads of a LogExecutor can drain.
+ *
+ * a sink is drained by one thread at a time, which keeps its events in
+ * order: the draining thread must TryAcquire() it first.
+ */
+class LogSink
+{
+public:
+    virtual ~LogSink() {}
+
+    // write at most max pending events, return how many were written.
+    virtual size_t Drain(size_t max) = 0;
+    virtual bool Pending() const = 0;
+    // true while output is held back until a deadline, Pending() then.
+    virtual bool Holding() const { return false; }
+    // crash path, from a signal handler: write out what is buffered with plain syscalls.
+    virtual void Salvage() {}
+
+    bool TryAcquire()
+    {
+        if( _draining.exchange(true, std::memory_order_acquire) )
+            return false;
+
+        _holder.store(Utility::CurrentThreadID(), std::memory_order_relaxed);
+        return true;
+    }
+    void Release()
+    {
+        _holder.store(0, std::memory_order_relaxed);
+        _passes.fetch_add(1, std::memory_order_relaxed);
+        _draining.store(false, std::memory_order_release);
+    }
+
+    // thread draining the sink, 0 if none.
+    unsigned int Holder() const { return _holder.load(std::memory_order_relaxed); }
+    // counts finished drains, tells a stuck sink from a slow one.
+    uint64_t Passes() const { return _passes.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic_bool _draining{false};
+    std::atomic<unsigned int> _holder{0};
+    std::atomic<uint64_t> _passes{0};
+};
+
+/**
+ * opt-in handler of fatal signals.
+ *
+ * on SIGSEGV, SIGBUS, SIGFPE, SIGILL or SIGABRT the writers get up to
+ * timeout_ms to drain their queues, flushing every batch meanwhile.
+ * each drained sink is then acquired for good and salvaged, i.e. what
+ * its appender still buffers goes out with write(2), and the signal is
+ * raised again with the default action.
+ *
+ * the handler itself only touches atomics and async-signal-safe calls,
+ * the formatting is left to the writers on their own threads. writers
+ * may still be stuck on a lock the crashed thread held (malloc's, a
+ * park mutex): the wait ends once no sink finished a drain for STALL_MS,
+ * and the sinks still behind are then salvaged without their queues. a
+ * crash inside a writer leaves that writer's sink alone.
+ *
+ * a stack overflow only reaches the handler on a thread with an
+ * alternate signal stack: Install() sets one up for the calling thread
+ * and for the library's writer threads, other threads call
+ * InstallThread().
+ */
+class CrashHandler
+{
+    static const int MAX_SINKS = 64;
+    static const int STALL_MS = 100;
+    static const size_t ALT_STACK_SIZE = 64 * 1024;
+
+public:
+    static void Install(unsigned int timeout_ms = 2000)
+    {
+        TimeoutMs().store(timeout_ms, std::memory_order_relaxed);
+        InstallThread();
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &CrashHandler::OnSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+        for(int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+            sigaction(sig, &action, nullptr);
+
+        InstalledFlag().store(true, std::memory_order_release);
+    }
+
+    static bool Installed()
+    {
+        return InstalledFlag().load(std::memory_order_acquire);
+    }
+
+    // an alternate signal stack for the calling thread, freed at its exit.
+    static void InstallThread()
+    {
+        static thread_local AltStack alt_stack;
+        alt_stack.Install();
+    }
+
+    static bool Crashing()
+    {
+        return CrashingFlag().load(std::memory_order_relaxed);
+    }
+
+    // running sinks, lock free so the handler can walk them.
+    static void Register(LogSink* sink)
+    {
+        for(int index = 0; index < MAX_SINKS; index++){
+            LogSink* expected = nullptr;
+            if( Sinks()[index].compare_exchange_strong(expected, sink) )
+                return;
+        }
+
+        if( Installed() )
+            std::cerr << "more than " << MAX_SINKS << " running appenders, a crash won't salvage the rest" << std::endl;
+    }
+    static void Unregister(LogSink* sink)
+    {
+        for(int index = 0; index < MAX_SINKS; index++){
+            LogSink* expected = sink;
+            if( Sinks()[index].compare_exchange_strong(expected, nullptr) )
+                return;
+        }
+    }
+
+private:
+    struct AltStack
+    {
+        stack_t stack{nullptr, 0, 0};
+
+        void Install()
+        {
+            if( stack.ss_sp != nullptr )
+                return;
+
+            stack.ss_sp = malloc(ALT_STACK_SIZE);
+            stack.ss_size = ALT_STACK_SIZE;
+            if( stack.ss_sp != nullptr && sigaltstack(&stack, nullptr) != 0 ){
+                free(stack.ss_sp);
+                stack.ss_sp = nullptr;
+            }
+        }
+        ~AltStack()
+        {
+            if( stack.ss_sp == nullptr )
+                return;
+
+            stack_t disable{nullptr, SS_DISABLE, 0};
+            sigaltstack(&disable, nullptr);
+            free(stack.ss_sp);
+        }
+    };
+
+    static void OnSignal(int sig)
+    {
+        // a second crashing thread waits for the first to end the process.
+        if( CrashingFlag().exchange(true) ){
+            for(;;)
+                pause();
+        }
+
+        Salvage();
+        raise(sig);
+    }
+
+    static int64_t NowMs()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000ll + now.tv_nsec / 1000000;
+    }
+
+    static void Salvage()
+    {
+        unsigned int self = static_cast<unsigned int>(syscall(SYS_gettid));
+        bool finished[MAX_SINKS] = {false};
+        uint64_t passes[MAX_SINKS] = {0};
+        int64_t now = NowMs();
+        int64_t deadline = now + TimeoutMs().load(std::memory_order_relaxed);
+        int64_t stalled = now + STALL_MS;
+
+        for(;;){
+            bool done = true;
+            for(int index = 0; index < MAX_SINKS; index++){
+                LogSink* sink = Sinks()[index].load();
+                if( sink == nullptr || finished[index] )
+                    continue;
+
+                // the crash happened while this thread drained the sink.
+                if( sink->Holder() == self ){
+                    finished[index] = true;
+                    continue;
+                }
+
+                if( !sink->Pending() && sink->TryAcquire() ){
+                    sink->Salvage();
+                    finished[index] = true;
+                    continue;
+                }
+
+                done = false;
+                if( sink->Passes() != passes[index] ){
+                    passes[index] = sink->Passes();
+                    stalled = now + STALL_MS;
+                }
+            }
+
+            now = NowMs();
+            if( done )
+                return;
+            if( now >= deadline || now >= stalled )
+                break;
+
+            timespec pause_time = {0, 1000000};
+            nanosleep(&pause_time, nullptr);
+        }
+
+        // out of time: what the sinks buffer still goes out, their queues don't.
+        for(int index = 0; index < MAX_SINKS; index++){
+            LogSink* sink = Sinks()[index].load();
+            if( sink != nullptr && !finished[index] && sink->TryAcquire() )
+                sink->Salvage();
+        }
+    }
+
+    static std::atomic<LogSink*>* Sinks()
+    {
+        static std::atomic<LogSink*> sinks[MAX_SINKS];
+        return sinks;
+    }
+    static std::atomic_bool& CrashingFlag()
+    {
+        static std::atomic_bool crashing{false};
+        return crashing;
+    }
+    static std::atomic_bool& InstalledFlag()
+    {
+        static std::atomic_bool installed{false};
+        return installed;
+    }
+    static std::atomic<unsigned int>& TimeoutMs()
+    {
+        static std::atomic<unsigned int> timeout_ms{2000};
+        return timeout_ms;
+    }
+};
+
+/**
+ * shared pool of writer threads.
+ *
+ * every appender runs its own writer thread by default; appenders given
+ * an executor register as sinks instead and its fixed pool of threads
+ * services all of them. each pass visits the sinks round robin, starting
+ * one further on every pass, and drains at most SINK_QUOTA events per
+ * sink, so a busy sink can't starve the others.
+ */
+class LogExecutor
+{
+    static const int SPIN_BEFORE_PARK = 64;
+
+public:
+    static const size_t SINK_QUOTA = 256;
+    // how often parked threads look at sinks holding output back.
+    static const int HOLD_POLL_MS = 50;
+
+    explicit LogExecutor(size_t thread_count = 1)
+    {
+        if( thread_count == 0 )
+            throw std::invalid_argument("at least one thread.");
+
+        for(size_t index = 0; index < thread_count; index++)
+            _threads.push_back(std::thread(&LogExecutor::Run, this));
+    }
+    ~LogExecutor()
+    {
+        _stop = true;
+
+        {
+            std::lock_guard<std::mutex> lock(_park_mtx);
+            _park_cond.notify_all();
+        }
+
+        for(auto& thread : _threads)
+            thread.join();
+    }
+
+    LogExecutor(const LogExecutor&) = delete;
+    LogExecutor& operator=(const LogExecutor&) = delete;
+
+    size_t ThreadCount() const { return _threads.size(); }
+
+    void Register(LogSink* sink)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_sinks_mtx);
+            _sinks.push_back(sink);
+        }
+
+        WakeUp();
+    }
+
+    /**
+     * once this returns no thread drains the sink any more; the sink is
+     * left acquired for the caller, which must Release() it.
+     */
+    void Unregister(LogSink* sink)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_sinks_mtx);
+            _sinks.erase(std::remove(_sinks.begin(), _sinks.end(), sink), _sinks.end());
+        }
+
+        while( !sink->TryAcquire() )
+            std::this_thread::yield();
+    }
+
+    // called by producers, only locks when a thread is parked.
+    void WakeUp()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( _parked.load(std::memory_order_relaxed) == 0 )
+            return;
+
+        std::lock_guard<std::mutex> lock(_park_mtx);
+        _park_cond.notify_one();
+    }
+
+private:
+    void Run()
+    {
+        if( CrashHandler::Installed() )
+            CrashHandler::InstallThread();
+
+        while( !_stop ){
+            if( Pass() == 0 )
+                Park();
+        }
+
+        while( Pass() > 0 );
+    }
+
+    size_t Pass()
+    {
+        size_t start = _cursor.fetch_add(1, std::memory_order_relaxed);
+        size_t drained = 0;
+
+        for(size_t visit = 0; ; visit++){
+            LogSink* sink = nullptr;
+            {
+                // sinks are only picked under the lock, see Unregister.
+                std::lock_guard<std::mutex> lock(_sinks_mtx);
+                if( visit >= _sinks.size() )
+                    break;
+
+                sink = _sinks[(start + visit) % _sinks.size()];
+                if( !sink->TryAcquire() )
+                    continue;
+            }
+
+            drained += sink->Drain(SINK_QUOTA);
+            sink->Release();
+        }
+
+        return drained;
+    }
+
+    bool AnyPending()
+    {
+        std::lock_guard<std::mutex> lock(_sinks_mtx);
+        for(auto sink : _sinks){
+            if( sink->Pending() )
+                return true;
+        }
+
+        return false;
+    }
+
+    bool AnyHolding()
+    {
+        std::lock_guard<std::mutex> lock(_sinks_mtx);
+        for(auto sink : _sinks){
+            if( sink->Holding() )
+                return true;
+        }
+
+        return false;
+    }
+
+    void Park()
+    {
+        for(int spin = 0; spin < SPIN_BEFORE_PARK; spin++){
+            if( AnyPending() || _stop )
+                return;
+            sched_yield();
+        }
+
+        std::unique_lock<std::mutex> lock(_park_mtx);
+        _parked.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        int poll_ms = HOLD_POLL_MS;
+        if( AnyHolding() )
+            _park_cond.wait_for(lock, std::chrono::milliseconds(poll_ms), [this]{ return _stop || AnyPending();});
+        else
+            _park_cond.wait(lock, [this]{ return _stop || AnyPending();});
+        _parked.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::vector<LogSink*> _sinks;
+    std::mutex _sinks_mtx;
+    std::atomic<size_t> _cursor{0};
+
+    std::mutex _park_mtx;
+    std::condition_variable _park_cond;
+    std::atomic<int> _parked{0};
+
+    std::atomic_bool _stop{false};
+    std::vector<std::thread> _threads;
+};
+
+class Appender
+{
+class Work
+    : public LogSink
+{
+    static const int SPIN_BEFORE_PARK = 64;
+    static const int DROPPED_REPORT_MS = 1000;
+    static const int LEVEL_COUNT = static_cast<int>(Level::OFF) + 1;
+
+public:
+    Work(Appender* appender) : _appender(appender)
+    {
+        const Configure& cfg = Configure::Instance();
+        _log_queue.reset(new RingQueue<LogEvent>(cfg.GetQueueCapacity()));
+        _overflow_policy = static_cast<int>(cfg.GetOverflowPolicy());
+        _overflow_level = static_cast<int>(cfg.GetOverflowLevel());
+
+        for(int index = 0; index < LEVEL_COUNT; index++){
+            _dropped[index] = 0;
+            _reported[index] = 0;
+        }
+    }
+
+    /**
+     * the queue is bounded, when it is full the overflow policy decides
+     * between waiting and dropping.
+     */
+    void Post(const LogEvent& e)
+    {
+        if( _stop )
+            return;
+
+        bool sample = WorkMetrics::Sample();
+        std::chrono::steady_clock::time_point begin;
+        if( sample )
+            begin = std::chrono::steady_clock::now();
+
+        LogEvent log_ev(e);
+        if( !_log_queue->TryPush(std::move(log_ev)) )
+            Overflow(log_ev);
+
+        WakeUp();
+
+        _metrics.Enqueued();
+        if( sample )
+            _metrics.EnqueueLatency(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+    }
+
+    void SetCapacity(size_t capacity)
+    {
+        if( capacity == 0 || capacity > Configure::MAX_QUEUE_CAPACITY )
+            throw std::invalid_argument("valid range: (0, 1M] events.");
+
+        if( !_stop )
+            throw std::logic_error("stop the appender before changing its queue capacity.");
+
+        _log_queue.reset(new RingQueue<LogEvent>(capacity));
+    }
+    size_t Capacity() const { return _log_queue->Capacity(); }
+
+    void SetOverflowPolicy(OverflowPolicy policy, const Level& level)
+    {
+        _overflow_level.store(static_cast<int>(level), std::memory_order_relaxed);
+        _overflow_policy.store(static_cast<int>(policy), std::memory_order_relaxed);
+    }
+    OverflowPolicy GetOverflowPolicy() const
+    {
+        return static_cast<OverflowPolicy>(_overflow_policy.load(std::memory_order_relaxed));
+    }
+
+    void SetCollapseRepeats(bool collapse, unsigned int flush_ms)
+    {
+        _collapse_ms.store(collapse ? std::max(flush_ms, 1u) : 0, std::memory_order_relaxed);
+    }
+
+    // events of this level dropped since the appender was created.
+    uint64_t DroppedCount(const Level& level) const
+    {
+        return _dropped[static_cast<int>(level)].load(std::memory_order_relaxed);
+    }
+
+    void Rotated()
+    {
+        _metrics.Rotated();
+    }
+
+    // the shared event being formatted, if e is one.
+    SharedEvent* Sharing(const LogEvent& e) const
+    {
+        return _sharing != nullptr && &_sharing->Event() == &e ? _sharing : nullptr;
+    }
+
+    void Snapshot(AppenderMetrics& metrics) const
+    {
+        metrics.queue_capacity = _log_queue->Capacity();
+        metrics.queue_depth = _log_queue->Size();
+        for(int index = 0; index < LEVEL_COUNT; index++)
+            metrics.dropped[index] = DroppedCount(static_cast<Level>(index));
+
+        _metrics.Snapshot(metrics);
+    }
+
+    /**
+     * run on a shared executor instead of an own writer thread, nullptr
+     * goes back to the own thread.
+     */
+    void SetExecutor(const std::shared_ptr<LogExecutor>& executor)
+    {
+        if( !_stop )
+            throw std::logic_error("stop the appender before changing its executor.");
+
+        _executor = executor;
+    }
+
+    void Stop()
+    {
+        _stop = true;
+        CrashHandler::Unregister(this);
+
+        if( _executor ){
+            if( _registered ){
+                // whatever is left is written by the caller.
+                _executor->Unregister(this);
+                while( Drain(_log_queue->Capacity()) > 0 );
+                Release();
+                _registered = false;
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_park_mtx);
+            _park_cond.notify_all();
+        }
+
+        if( _log_loop_thread.joinable() )
+            _log_loop_thread.join();
+
+    }
+
+    void Start()
+    {
+        if( _registered || _log_loop_thread.joinable() )
+            return;
+
+        _stop = false;
+        CrashHandler::Register(this);
+        if( _executor ){
+            _executor->Register(this);
+            _registered = true;
+            return;
+        }
+
+        _log_loop_thread = std::thread(&Work::WriteLogThread, this);
+        while( !_thread_exec );
+    }
+
+    void Restart()
+    {
+        Stop();
+        Start();
+    }
+
+private:
+    // the queue is full, apply the overflow policy.
+    void Overflow(LogEvent& log_ev)
+    {
+        OverflowPolicy policy = GetOverflowPolicy();
+        int level_t = static_cast<int>(log_ev.LogLevel());
+
+        if( policy == OverflowPolicy::DROP_NEWEST ||
+            (policy == OverflowPolicy::DROP_BELOW_LEVEL && level_t < _overflow_level.load(std::memory_order_relaxed)) ){
+            Drop(log_ev.LogLevel());
+            return;
+        }
+
+        LogEvent oldest;
+        while( !_log_queue->TryPush(std::move(log_ev)) ){
+            if( _stop )
+                return;
+
+            if( policy == OverflowPolicy::DROP_OLDEST ){
+                if( _log_queue->TryPop(oldest) )
+                    Drop(oldest.LogLevel());
+                continue;
+            }
+
+            WakeUp();
+            std::this_thread::yield();
+        }
+    }
+
+    void Drop(const Level& level)
+    {
+        _dropped[static_cast<int>(level)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * once the queue is drained, or at least every DROPPED_REPORT_MS under
+     * sustained overload, add a "N messages dropped" line for the drops
+     * not reported yet.
+     */
+    void ReportDropped(LogBatch& batch)
+    {
+        static const char* LEVEL_NAMES[LEVEL_COUNT] = {"ALL", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", "OFF"};
+
+        _dropped_deadline = NowNs() + DROPPED_REPORT_MS * 1000000ull;
+
+        uint64_t total = 0;
+        std::string detail;
+        for(int index = 0; index < LEVEL_COUNT; index++){
+            uint64_t dropped = _dropped[index].load(std::memory_order_relaxed);
+            uint64_t count = dropped - _reported[index];
+            if( count == 0 )
+                continue;
+
+            _reported[index] = dropped;
+            total += count;
+
+            detail.append(detail.empty() ? "" : ", ");
+            detail.append(LEVEL_NAMES[index]).append(":").append(std::to_string(count));
+        }
+
+        if( total == 0 )
+            return;
+
+        std::string text(std::to_string(total));
+        text.append(" messages dropped (").append(detail).append(")");
+
+        LogEvent log_ev(Utility::CurrentThreadID(), "log4cpp", Level::WARN, text.c_str());
+        _appender->Format(log_ev, batch);
+        batch.NoteLevel(log_ev.LogLevel());
+    }
+
+    void WriteLogThread()
+    {
+        if( CrashHandler::Installed() )
+            CrashHandler::InstallThread();
+        _thread_exec = true;
+
+        while(!_stop){
+            if( DrainOwned() == 0 )
+                Park();
+        }
+
+        while( DrainOwned() > 0 );
+        _thread_exec = false;
+    }
+
+    // the sink is held while draining, only CrashHandler competes for it.
+    size_t DrainOwned()
+    {
+        while( !TryAcquire() )
+            sched_yield();
+
+        size_t count = Drain(_log_queue->Capacity());
+        Release();
+        return count;
+    }
+
+    /**
+     * take everything pending (up to max events), format it into one
+     * batch and hand it to the appender as a single write.
+     */
+    size_t Drain(size_t max) override
+    {
+        _log_batch.Clear();
+
+        size_t depth = _log_queue->Size();
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+        size_t count = 0;
+        {
+            ReadCopyUpdate::Guard guard(_appender->_formatter_rcu);
+            unsigned int collapse_ms = _collapse_ms.load(std::memory_order_relaxed);
+            while( count < max && _log_queue->TryPop(_log_ev) ){
+                _sharing = _log_ev.Shared().get();
+                const LogEvent& log_ev = _sharing ? _sharing->Event() : _log_ev;
+                count++;
+                if( collapse_ms > 0 && Repeated(log_ev, collapse_ms) )
+                    continue;
+
+                _appender->Format(log_ev, _log_batch);
+                _log_batch.NoteLevel(log_ev.LogLevel());
+            }
+            _sharing = nullptr;
+            _log_ev = LogEvent();
+
+            if( _repeats > 0 && (_stop || collapse_ms == 0 || RepeatDeadline() <= NowNs()) )
+                ReportRepeats(_log_batch);
+
+            if( _log_queue->Empty() || _dropped_deadline <= NowNs() )
+                ReportDropped(_log_batch);
+        }
+
+        if( !_log_batch.Empty() ){
+            std::chrono::steady_clock::time_point formatted = std::chrono::steady_clock::now();
+            _appender->Output(_log_batch);
+            if( _log_queue->Empty() )
+                _appender->Sync();
+            std::chrono::steady_clock::time_point written = std::chrono::steady_clock::now();
+
+            _metrics.Written(depth,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(formatted - begin).count(),
+                std::chrono::duration_cast<std::chrono::nanoseconds>(written - formatted).count(),
+                _log_batch.Size(), _log_batch.Count());
+        }
+
+        // buffered lines go out on Stop() and once the flush interval is over.
+        if( _log_queue->Empty() && (_stop || FlushOverdue()) )
+            _appender->Flush();
+
+        return count;
+    }
+
+    /**
+     * spin a little, then sleep until a producer posts.
+     *
+     * producers publish then check _parked, we set _parked then check the
+     * queue; the fences make sure at least one side sees the other.
+     */
+    void Park()
+    {
+        for(int spin = 0; spin < SPIN_BEFORE_PARK; spin++){
+            if( !_log_queue->Empty() || _stop )
+                return;
+            sched_yield();
+        }
+
+        std::unique_lock<std::mutex> lock(_park_mtx);
+        _parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        auto ready = [this]{ return !_log_queue->Empty() || _stop;};
+        uint64_t deadline = Deadline();
+        if( deadline != 0 )
+            _park_cond.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline)), ready);
+        else
+            _park_cond.wait(lock, ready);
+        _parked.store(false, std::memory_order_relaxed);
+    }
+
+    bool Pending() const override
+    {
+        if( !_log_queue->Empty() )
+            return true;
+
+        uint64_t deadline = Deadline();
+        return deadline != 0 && deadline <= NowNs();
+    }
+
+    bool Holding() const override
+    {
+        return Deadline() != 0;
+    }
+
+    void Salvage() override
+    {
+        _appender->Salvage();
+    }
+
+    /**
+     * true when log_ev repeats the previous event, by level, module and
+     * a hash of its text and fields: it is then only counted. the first
+     * different event, a flush timeout or Stop() ends the run with a
+     * "last message repeated N times" line.
+     */
+    bool Repeated(const LogEvent& log_ev, unsigned int collapse_ms)
+    {
+        uint64_t hash = HashEvent(log_ev);
+        if( hash == _last_hash && log_ev.LogLevel() == _last_level && strcmp(log_ev.Module(), _last_module.c_str()) == 0 ){
+            if( _repeats++ == 0 )
+                _repeat_deadline.store(NowNs() + collapse_ms * 1000000ull, std::memory_order_relaxed);
+            return true;
+        }
+
+        if( _repeats > 0 )
+            ReportRepeats(_log_batch);
+
+        _last_hash = hash;
+        _last_level = log_ev.LogLevel();
+        _last_module.assign(log_ev.Module());
+        return false;
+    }
+
+    void ReportRepeats(LogBatch& batch)
+    {
+        std::string text("last message repeated ");
+        text.append(std::to_string(_repeats)).append(" times");
+        _repeats = 0;
+        _repeat_deadline.store(0, std::memory_order_relaxed);
+
+        LogEvent log_ev(Utility::CurrentThreadID(), _last_module.c_str(), _last_level, text.c_str());
+        _appender->Format(log_ev, batch);
+        batch.NoteLevel(log_ev.LogLevel());
+    }
+
+    uint64_t RepeatDeadline() const
+    {
+        return _repeat_deadline.load(std::memory_order_relaxed);
+    }
+
+    // the nearer of the repeat and the flush deadline, 0 if neither is set.
+    uint64_t Deadline() const
+    {
+        uint64_t repeat = RepeatDeadline();
+        uint64_t flush = _appender->_flush_deadline.load(std::memory_order_relaxed);
+        if( repeat == 0 || flush == 0 )
+            return repeat | flush;
+
+        return std::min(repeat, flush);
+    }
+
+    bool FlushOverdue() const
+    {
+        uint64_t deadline = _appender->_flush_deadline.load(std::memory_order_relaxed);
+        return CrashHandler::Crashing() || (deadline != 0 && deadline <= NowNs());
+    }
+
+public:
+    static uint64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    static uint64_t HashEvent(const LogEvent& log_ev)
+    {
+        uint64_t hash = 0;
+        if( log_ev.Deferred() ){
+            hash = HashBytes(log_ev.FormatString(), strlen(log_ev.FormatString()), hash);
+            hash = HashBytes(log_ev.Args().Data(), log_ev.Args().Size(), hash);
+        }else{
+            hash = HashBytes(log_ev.Text().data(), log_ev.Text().size(), hash);
+        }
+        return HashBytes(log_ev.Fields().Data(), log_ev.Fields().Size(), hash);
+    }
+
+    // 8 bytes a step, good enough to tell log lines apart.
+    static uint64_t HashBytes(const char* data, size_t len, uint64_t hash)
+    {
+        const uint64_t MUL = 0x9e3779b97f4a7c15ull;
+        hash ^= len * MUL;
+        size_t index = 0;
+        for(; index + 8 <= len; index += 8){
+            uint64_t word;
+            memcpy(&word, data + index, 8);
+            hash = (hash ^ word) * MUL;
+            hash ^= hash >> 32;
+        }
+
+        uint64_t tail = 0;
+        memcpy(&tail, data + index, len - index);
+        hash = (hash ^ tail) * MUL;
+        return hash ^ (hash >> 29);
+    }
+
+    void WakeUp()
+    {
+        if( _executor ){
+            _executor->WakeUp();
+            return;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( !_parked.load(std::memory_order_relaxed) )
+            return;
+
+        std::lock_guard<std::mutex> lock(_park_mtx);
+        _park_cond.notify_one();
+    }
+
+private:
+    std::unique_ptr<RingQueue<LogEvent>> _log_queue;
+
+    std::atomic<int> _overflow_policy;
+    std::atomic<int> _overflow_level;
+    std::atomic<uint64_t> _dropped[LEVEL_COUNT];
+    WorkMetrics _metrics;
+
+    // writer thread only.
+    LogEvent _log_ev;
+    SharedEvent* _sharing{nullptr};
+
+    // repeat collapsing, 0 ms is off; the run is writer thread only.
+    std::atomic<unsigned int> _collapse_ms{0};
+    std::atomic<uint64_t> _repeat_deadline{0};
+    uint64_t _repeats{0};
+    uint64_t _last_hash{0};
+    Level _last_level{Level::ALL};
+    std::string _last_module;
+    LogBatch _log_batch;
+    uint64_t _reported[LEVEL_COUNT];
+    uint64_t _dropped_deadline{0};
+
+    std::mutex _park_mtx;
+    std::condition_variable _park_cond;
+    std::atomic_bool _parked {false};
+
+    std::atomic_bool _stop {true};
+    std::thread _log_loop_thread;
+    std::atomic_bool _thread_exec {false};
+
+    std::shared_ptr<LogExecutor> _executor;
+    bool _registered{false};
+
+    Appender* _appender{nullptr};
+};
+
+    friend class Logger;
+protected:
+    Appender() : _worker(this)
+    {
+    }
+
+public:
+    virtual ~Appender() {}
+
+    /**
+     * may be called while the appender runs: the writer picks the new
+     * formatter up with its next batch, the old one is released once no
+     * batch uses it any more.
+     */
+    virtual void SetFormatter(const std::shared_ptr<Log4CPP::Formatter>& formatter)
+    {
+        std::lock_guard<std::mutex> lock(_formatter_mtx);
+        std::shared_ptr<Log4CPP::Formatter> old = _log_formatter;
+        _log_formatter = formatter;
+        _formatter.store(formatter.get(), std::memory_order_release);
+        _formatter_rcu.Synchronize();
+    }
+
+    void Append(const LogEvent& e)
+    {
+        _worker.Post(e);
+    }
+
+public:
+    void Stop()
+    {
+        _worker.Stop();
+    }
+
+    void Start()
+    {
+        _worker.Start();
+    }
+
+    void Restart()
+    {
+        _worker.Restart();
+    }
+
+    /**
+     * let a shared LogExecutor write this appender's events instead of
+     * its own thread, nullptr goes back to the own thread.
+     *
+     * NOTE:
+     * only while the appender is stopped, throw std::logic_error otherwise.
+     */
+    void SetExecutor(const std::shared_ptr<LogExecutor>& executor)
+    {
+        _worker.SetExecutor(executor);
+    }
+
+    /**
+     * queue capacity in events, rounded up to a power of 2.
+     *
+     * NOTE:
+     * only while the appender is stopped, throw std::logic_error otherwise.
+     */
+    void SetQueueCapacity(size_t capacity)
+    {
+        _worker.SetCapacity(capacity);
+    }
+    size_t GetQueueCapacity() const { return _worker.Capacity(); }
+
+    // level only matters for DROP_BELOW_LEVEL.
+    void SetOverflowPolicy(OverflowPolicy policy, const Level& level = Level::WARN)
+    {
+        _worker.SetOverflowPolicy(policy, level);
+    }
+    OverflowPolicy GetOverflowPolicy() const { return _worker.GetOverflowPolicy(); }
+
+    /**
+     * collapse runs of the same event (level, module and text) into the
+     * first one and a "last message repeated N times" line, written when
+     * the run ends or flush_ms after its first repeat.
+     */
+    void SetCollapseRepeats(bool collapse, unsigned int flush_ms = 1000)
+    {
+        _worker.SetCollapseRepeats(collapse, flush_ms);
+    }
+
+    /**
+     * when buffering appenders write out, see FlushPolicy; appenders
+     * without a buffer of their own ignore it.
+     */
+    void SetFlushPolicy(const FlushPolicy& policy)
+    {
+        _flush_bytes.store(policy.bytes, std::memory_order_relaxed);
+        _flush_ms.store(policy.interval_ms, std::memory_order_relaxed);
+        _flush_level.store(policy.level, std::memory_order_relaxed);
+    }
+    FlushPolicy GetFlushPolicy() const
+    {
+        FlushPolicy policy;
+        policy.bytes = _flush_bytes.load(std::memory_order_relaxed);
+        policy.interval_ms = _flush_ms.load(std::memory_order_relaxed);
+        policy.level = _flush_level.load(std::memory_order_relaxed);
+        return policy;
+    }
+
+    uint64_t GetDroppedCount(const Level& level) const
+    {
+        return _worker.DroppedCount(level);
+    }
+
+    // e.g. the file path, names the appender in metrics.
+    virtual std::string Name() const
+    {
+        return "appender";
+    }
+
+    AppenderMetrics GetMetrics() const
+    {
+        AppenderMetrics metrics;
+        metrics.name = Name();
+        _worker.Snapshot(metrics);
+        return metrics;
+    }
+
+protected:
+    // rotating appenders report each rotation for the metrics.
+    void CountRotation()
+    {
+        _worker.Rotated();
+    }
+
+    virtual void Output(const std::string& log_str) = 0;
+
+    /**
+     * write a whole batch at once.
+     *
+     * the default falls back to one Output per record, so appenders that
+     * only know single lines keep working.
+     */
+    virtual void Output(const LogBatch& batch)
+    {
+        for(size_t index = 0; index < batch.Count(); index++)
+            Output(batch.Record(index));
+    }
+
+    /**
+     * called once the writer has caught up with the queue, appenders
+     * that write asynchronously reap finished writes here, without
+     * waiting for the others.
+     */
+    virtual void Sync()
+    {
+    }
+
+    /**
+     * write out what the appender buffers, called on Stop(), when the
+     * flush interval is over and while crashing.
+     */
+    virtual void Flush()
+    {
+    }
+
+    // see LogSink::Salvage, plain syscalls only.
+    virtual void Salvage()
+    {
+    }
+
+    /**
+     * buffering appenders call this with what a batch added to the
+     * buffer, true when FlushPolicy says to write out now. Flush()
+     * then calls Flushed().
+     */
+    bool FlushDue(size_t bytes, const Level& level)
+    {
+        _unflushed += bytes;
+        if( _unflushed >= _flush_bytes.load(std::memory_order_relaxed) ||
+            level >= _flush_level.load(std::memory_order_relaxed) || CrashHandler::Crashing() )
+            return true;
+
+        unsigned int interval_ms = _flush_ms.load(std::memory_order_relaxed);
+        if( interval_ms == 0 )
+            return false;
+
+        uint64_t now = Work::NowNs();
+        uint64_t deadline = _flush_deadline.load(std::memory_order_relaxed);
+        if( deadline == 0 ){
+            deadline = now + interval_ms * 1000000ull;
+            _flush_deadline.store(deadline, std::memory_order_relaxed);
+        }
+
+        return deadline <= now;
+    }
+    void Flushed()
+    {
+        _unflushed = 0;
+        _flush_deadline.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * one event into the batch, by default a line from the formatter.
+     *
+     * an event shared with other appenders is formatted once per
+     * formatter: the first writer claims the line and formats it, the
+     * others wait for it and copy it. with no free slot, or a claiming
+     * writer too slow, a writer formats the line itself.
+     */
+    virtual void Format(const LogEvent& log_ev, LogBatch& batch)
+    {
+        Formatter* formatter = _formatter.load(std::memory_order_acquire);
+        LogBuffer& record = batch.BeginRecord();
+
+        SharedEvent* shared = _worker.Sharing(log_ev);
+        if( shared == nullptr ){
+            formatter->FormatInto(log_ev, record);
+            batch.EndRecord();
+            return;
+        }
+
+        LogBuffer* slot = shared->Claim(formatter->ID());
+        if( slot != nullptr ){
+            formatter->FormatInto(log_ev, *slot);
+            shared->Publish(slot);
+            record.Append(slot->Data(), slot->Size());
+            batch.EndRecord();
+            return;
+        }
+
+        const LogBuffer* line = shared->Wait(formatter->ID());
+        if( line != nullptr )
+            record.Append(line->Data(), line->Size());
+        else
+            formatter->FormatInto(log_ev, record);
+        batch.EndRecord();
+    }
+
+private:
+    // read by the writer, _unflushed and the deadline are its own.
+    std::atomic<size_t> _flush_bytes{0};
+    std::atomic<unsigned int> _flush_ms{0};
+    std::atomic<Level> _flush_level{Level::ERROR};
+    size_t _unflushed{0};
+    std::atomic<uint64_t> _flush_deadline{0};
+
+    Work _worker;
+
+    // the writer formats through _formatter inside a _formatter_rcu guard.
+    std::shared_ptr<Log4CPP::Formatter> _log_formatter;
+    std::atomic<Log4CPP::Formatter*> _formatter{nullptr};
+    ReadCopyUpdate _formatter_rcu;
+    std::mutex _formatter_mtx;
+};
+
+class ConsoleAppender
+    : public Appender
+    , public std::enable_shared_from_this<ConsoleAppender>
+{
+private:
+    ConsoleAppender()
+    {
+    }
+public:
+    static std::shared_ptr<ConsoleAppender>& Get()
+    {
+        static std::shared_ptr<ConsoleAppender> _instance(new ConsoleAppender);
+        return _instance;
+    }
+
+    ~ConsoleAppender()
+    {
+        Stop();
+    }
+
+    std::string Name() const override
+    {
+        return "console";
+    }
+
+private:
+    void Output(const std::string& log_str) override
+    {
+        //std::cout << log_str << std::endl;
+        printf("%s\n", log_str.c_str());
+    }
+
+    void Output(const LogBatch& batch) override
+    {
+        fwrite(batch.Data(), 1, batch.Size(), stdout);
+        fflush(stdout);
+    }
+};
+
+/**
+ * gzips rotated log files on one low priority background thread.
+ *
+ * the writer thread only renames the full file to a pending name and
+ * posts it here, so writes never wait for compression. this thread
+ * compresses the pending file, then shifts file.1.gz ... file.N.gz and
+ * moves the result to file.1.gz; it is the only one touching the .gz
+ * backups, so the shifting needs no lock.
+ */
+class BackupCompressor
+{
+    struct Job
+    {
+        std::string pending_path;
+        std::string file_path;
+        unsigned int backup_count;
+    };
+
+    BackupCompressor() = default;
+
+public:
+    static BackupCompressor& Instance()
+    {
+        static BackupCompressor _instance;
+        return _instance;
+    }
+
+    ~BackupCompressor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_jobs_mtx);
+            _stop = true;
+            _jobs_cond.notify_all();
+        }
+
+        if( _thread.joinable() )
+            _thread.join();
+    }
+
+    void Post(const std::string& pending_path, const std::string& file_path, unsigned int backup_count)
+    {
+        std::lock_guard<std::mutex> lock(_jobs_mtx);
+        _jobs.push_back(Job{pending_path, file_path, backup_count});
+
+        if( !_thread.joinable() )
+            _thread = std::thread(&BackupCompressor::Run, this);
+
+        _jobs_cond.notify_all();
+    }
+
+    // block until every posted file is compressed.
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(_jobs_mtx);
+        _idle_cond.wait(lock, [this]{ return _jobs.empty() && !_busy;});
+    }
+
+private:
+    void Run()
+    {
+        setpriority(PRIO_PROCESS, Utility::CurrentThreadID(), 19);
+
+        std::unique_lock<std::mutex> lock(_jobs_mtx);
+        for(;;){
+            _jobs_cond.wait(lock, [this]{ return !_jobs.empty() || _stop;});
+            if( _jobs.empty() )
+                break;
+
+            Job job = _jobs.front();
+            _jobs.erase(_jobs.begin());
+            _busy = true;
+
+            lock.unlock();
+            Compress(job);
+            lock.lock();
+
+            _busy = false;
+            _idle_cond.notify_all();
+        }
+    }
+
+    static std::string BackupPath(const Job& job, unsigned int index)
+    {
+        std::string file_path(job.file_path);
+        file_path.append(".").append(std::to_string(index)).append(".gz");
+        return file_path;
+    }
+
+    void Compress(const Job& job)
+    {
+        std::string tmp_path(job.pending_path);
+        tmp_path.append(".gz");
+
+        // a pending file compressed before a crash only needs the shifting,
+        // one posted twice is already gone.
+        struct stat file_stat;
+        if( stat(job.pending_path.c_str(), &file_stat) != 0 ){
+            if( stat(tmp_path.c_str(), &file_stat) == 0 )
+                Shift(job, tmp_path);
+            return;
+        }
+
+        if( !Gzip(job.pending_path, tmp_path) ){
+            std::cerr << "fail to compress file " << job.pending_path << std::endl;
+            remove(tmp_path.c_str());
+            return;
+        }
+
+        remove(job.pending_path.c_str());
+        Shift(job, tmp_path);
+    }
+
+    void Shift(const Job& job, const std::string& tmp_path)
+    {
+        if( job.backup_count == 0 ){
+            remove(tmp_path.c_str());
+            return;
+        }
+
+        for(unsigned int index = job.backup_count; index > 1; index--){
+            const std::string& des_path = BackupPath(job, index);
+            remove(des_path.c_str());
+            rename(BackupPath(job, index - 1).c_str(), des_path.c_str());
+        }
+
+        rename(tmp_path.c_str(), BackupPath(job, 1).c_str());
+    }
+
+    static bool Gzip(const std::string& src_path, const std::string& des_path)
+    {
+#ifdef LOG4CPP_WITH_ZLIB
+        FILE* src = fopen(src_path.c_str(), "rb");
+        if( src == nullptr )
+            return false;
+
+        gzFile des = gzopen(des_path.c_str(), "wb6");
+        if( des == nullptr ){
+            fclose(src);
+            return false;
+        }
+
+        bool ok = true;
+        char buffer[64 * 1024];
+        size_t len = 0;
+        while( ok && (len = fread(buffer, 1, sizeof(buffer), src)) > 0 )
+            ok = gzwrite(des, buffer, len) == (int)len;
+
+        ok = ok && !ferror(src);
+        fclose(src);
+        return gzclose(des) == Z_OK && ok;
+#else
+        return false;
+#endif
+    }
+
+private:
+    std::vector<Job> _jobs;
+    std::mutex _jobs_mtx;
+    std::condition_variable _jobs_cond;
+    std::condition_variable _idle_cond;
+    bool _busy{false};
+    bool _stop{false};
+
+    std::thread _thread;
+};
+
+/**
+ * naming and rotation of a log file and its backups:
+ * file, file.1, ..., file.N with N the configured backup count, or
+ * file.1.gz ... file.N.gz with backup compression on.
+ */
+class RollingFile
+{
+public:
+    // file_path is relative to Configure's directory.
+    RollingFile(const char* file_path)
+    {
+        _file_path.assign(Configure::Instance().GetDirectory());
+        _file_path.append(file_path);
+
+        if( Configure::Instance().GetBackupCompress() )
+            RecoverPending();
+    }
+
+    const std::string& Path() const { return _file_path; }
+
+    // never full without backups, the file just keeps growing.
+    bool IsFull(unsigned long size) const
+    {
+        if( Configure::Instance().GetBackupCount() ==  0 )
+            return false;
+
+        return size >= MaxSize();
+    }
+
+    unsigned long MaxSize() const
+    {
+        return Configure::Instance().GetLogFileMaxSize() * 1024ul * 1024ul;
+    }
+
+    // the primary file must be closed.
+    void Backup()
+    {
+        if( Configure::Instance().GetBackupCompress() ){
+            BackupCompressed();
+            return;
+        }
+
+        for(int index = Configure::Instance().GetBackupCount(); index > 0; index--){
+            const std::string& src_log_file = ConstructLogFilePath(index - 1);
+            const std::string& des_log_file = ConstructLogFilePath(index);
+
+            // delete old bak log file.
+            remove(des_log_file.c_str());
+
+            struct stat file_stat;
+            if( stat(src_log_file.c_str(), &file_stat ) == 0 ){
+                rename(src_log_file.c_str(), des_log_file.c_str());
+            }
+        }
+
+        // delete primary log file.
+        remove(_file_path.c_str());
+    }
+
+    std::string ConstructLogFilePath(int index) const
+    {
+        std::string file_path(_file_path);
+        if( index > 0 )
+            file_path.append(".").append(std::to_string(index));
+
+        return file_path;
+    }
+
+private:
+    /**
+     * just a rename here, the shifting happens after compression.
+     * file.rotating.<time>.<pid>.<n>, unique across runs, so a rotation
+     * never overwrites a file left behind by an earlier one.
+     */
+    void BackupCompressed()
+    {
+        static const std::string _run = std::to_string(time(nullptr)) + "." + std::to_string(getpid()) + ".";
+        static std::atomic<unsigned int> _sequence{0};
+
+        std::string pending_path(_file_path);
+        pending_path.append(".rotating.").append(_run).append(std::to_string(_sequence.fetch_add(1)));
+
+        if( rename(_file_path.c_str(), pending_path.c_str()) != 0 )
+            return;
+
+        BackupCompressor::Instance().Post(pending_path, _file_path, Configure::Instance().GetBackupCount());
+    }
+
+    // post file.rotating.* left behind by a crash, oldest first.
+    void RecoverPending()
+    {
+        size_t slash = _file_path.rfind('/');
+        std::string dir_path = slash == std::string::npos ? "" : _file_path.substr(0, slash + 1);
+        std::string prefix = _file_path.substr(dir_path.size()) + ".rotating.";
+
+        DIR* dir = opendir(dir_path.empty() ? "." : dir_path.c_str());
+        if( dir == nullptr )
+            return;
+
+        std::set<std::string> pending;
+        while( struct dirent* entry = readdir(dir) ){
+            std::string name(entry->d_name);
+            if( name.compare(0, prefix.size(), prefix) != 0 )
+                continue;
+
+            if( name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0 )
+                name.resize(name.size() - 3);
+            pending.insert(name);
+        }
+        closedir(dir);
+
+        for(const std::string& name : pending)
+            BackupCompressor::Instance().Post(dir_path + name, _file_path, Configure::Instance().GetBackupCount());
+    }
+
+private:
+    std::string _file_path;
+};
+
+class FileAppender
+    : public Appender
+    , public std::enable_shared_from_this<FileAppender>
+{
+public:
+    /**
+     * file_path:
+     * file_count: max log file count.
+     * max_size_per_file: max size on MB per log file.
+     */
+    FileAppender(const char* file_path) : _rolling_file(file_path)
+    {
+        Open();
+    }
+    ~FileAppender()
+    {
+        Stop();
+        Close();
+    }
+
+    std::string Name() const override
+    {
+        return _rolling_file.Path();
+    }
+
+private:
+    bool Open()
+    {
+        _fd = open(_rolling_file.Path().c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if( _fd < 0 ){
+            std::cerr << "fail to open file " << _rolling_file.Path() << std::endl;
+            return false;
+        }
+
+        struct stat file_stat;
+        _size = fstat(_fd, &file_stat) == 0 ? file_stat.st_size : 0;
+        return true;
+    }
+    void Close()
+    {
+        Flush();
+        if( _fd >= 0 ){
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    void Output(const std::string& log_str) override
+    {
+        _pending.Append(log_str);
+        _pending.Append('\n');
+        _size += log_str.size() + 1;
+
+        if( IsFull() ){
+            Close();
+            Backup();
+
+            Open();
+        }else if( FlushDue(log_str.size() + 1, Level::ALL) ){
+            Flush();
+        }
+    }
+
+    /**
+     * records already end with '\n', they are buffered and written out
+     * as the FlushPolicy says, by default once per batch. the batch is
+     * only split where the file gets full, so rotation still happens at
+     * the max size.
+     */
+    void Output(const LogBatch& batch) override
+    {
+        size_t begin = 0;
+        for(size_t index = 0; index < batch.Count(); index++){
+            size_t end = batch.RecordEnd(index);
+            if( index + 1 < batch.Count() && !_rolling_file.IsFull(_size + end - begin) )
+                continue;
+
+            _pending.Append(batch.Data() + begin, end - begin);
+            _size += end - begin;
+            begin = end;
+
+            if( IsFull() ){
+                Close();
+                Backup();
+
+                Open();
+            }
+        }
+
+        if( FlushDue(batch.Size(), batch.MaxLevel()) )
+            Flush();
+    }
+
+    void Flush() override
+    {
+        if( _fd >= 0 )
+            WriteAll(_pending.Data(), _pending.Size());
+        _pending.Clear();
+        Flushed();
+    }
+
+    // from the crash handler: no allocation, no locks.
+    void Salvage() override
+    {
+        if( _fd >= 0 )
+            WriteAll(_pending.Data(), _pending.Size());
+    }
+
+    void WriteAll(const char* data, size_t len)
+    {
+        while( len > 0 ){
+            ssize_t written = write(_fd, data, len);
+            if( written < 0 && errno == EINTR )
+                continue;
+            if( written <= 0 )
+                return;
+
+            data += written;
+            len -= written;
+        }
+    }
+
+    bool IsFull()
+    {
+        return _rolling_file.IsFull(_size);
+    }
+
+    void Backup()
+    {
+        _rolling_file.Backup();
+        CountRotation();
+    }
+
+private:
+    int _fd{-1};
+    unsigned long _size{0};
+    // written but not yet flushed lines.
+    LogBuffer _pending;
+    RollingFile _rolling_file;
+};
+
+/**
+ * file appender writing through a shared memory mapping.
+ *
+ * the file is preallocated with fallocate up to the max log file size
+ * and mapped once, records are memcpy'd straight into the mapping. the
+ * file is truncated to its real length on rotation and close; after a
+ * crash the zero filled tail is skipped when the file is opened again.
+ *
+ * without backups the file never rotates, the mapping grows by another
+ * max log file size instead.
+ */
+class MmapFileAppender
+    : public Appender
+    , public std::enable_shared_from_this<MmapFileAppender>
+{
+public:
+    MmapFileAppender(const char* file_path) : _rolling_file(file_path)
+    {
+        Open();
+    }
+    ~MmapFileAppender()
+    {
+        Stop();
+        Close();
+    }
+
+    std::string Name() const override
+    {
+        return _rolling_file.Path();
+    }
+
+private:
+    bool Open()
+    {
+        _fd = open(_rolling_file.Path().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if( _fd < 0 ){
+            std::cerr << "fail to open file " << _rolling_file.Path() << std::endl;
+            return false;
+        }
+
+        struct stat file_stat;
+        if( fstat(_fd, &file_stat) != 0 ){
+            Close();
+            return false;
+        }
+
+        _length = 0;
+        _capacity = 0;
+        if( !Map(std::max<size_t>(file_stat.st_size, _rolling_file.MaxSize())) ){
+            Close();
+            return false;
+        }
 
-    void Append(const LogEvent& e)
+        // skip a zero filled tail left by a crash.
+        _length = file_stat.st_size;
+        while( _length > 0 && _mapping[_length - 1] == '\0' )
+            _length--;
+
+        return true;
+    }
+
+    void Close()
     {
-        _worker.Post(e);
+        if( _mapping != nullptr ){
+            munmap(_mapping, _capacity);
+            _mapping = nullptr;
+        }
+
+        if( _fd >= 0 ){
+            if( ftruncate(_fd, _length) != 0 )
+                std::cerr << "fail to truncate file " << _rolling_file.Path() << std::endl;
+
+            close(_fd);
+            _fd = -1;
+        }
+
+        _length = 0;
+        _capacity = 0;
+    }
+
+    // preallocate the file up to capacity and (re)map it.
+    bool Map(size_t capacity)
+    {
+        int ret = fallocate(_fd, 0, 0, capacity);
+        if( ret != 0 && (errno == EOPNOTSUPP || errno == ENOSYS) )
+            ret = ftruncate(_fd, capacity);
+
+        if( ret != 0 ){
+            std::cerr << "fail to preallocate file " << _rolling_file.Path() << std::endl;
+            return false;
+        }
+
+        void* mapping = nullptr;
+        if( _mapping == nullptr )
+            mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        else
+            mapping = mremap(_mapping, _capacity, capacity, MREMAP_MAYMOVE);
+
+        if( mapping == MAP_FAILED ){
+            std::cerr << "fail to map file " << _rolling_file.Path() << std::endl;
+            return false;
+        }
+
+        _mapping = static_cast<char*>(mapping);
+        _capacity = capacity;
+        return true;
+    }
+
+    void Write(const char* data, size_t len)
+    {
+        if( _mapping == nullptr )
+            return;
+
+        if( _length + len > _capacity ){
+            size_t capacity = _capacity;
+            while( _length + len > capacity )
+                capacity += _rolling_file.MaxSize();
+
+            if( !Map(capacity) )
+                return;
+        }
+
+        memcpy(_mapping + _length, data, len);
+        _length += len;
+    }
+
+    void Output(const std::string& log_str) override
+    {
+        Write(log_str.data(), log_str.size());
+        Write("\n", 1);
+
+        if( _rolling_file.IsFull(_length) )
+            Rotate();
+    }
+
+    // like FileAppender, the batch is only split where the file gets full.
+    void Output(const LogBatch& batch) override
+    {
+        size_t begin = 0;
+        for(size_t index = 0; index < batch.Count(); index++){
+            size_t end = batch.RecordEnd(index);
+            if( index + 1 < batch.Count() && !_rolling_file.IsFull(_length + end - begin) )
+                continue;
+
+            Write(batch.Data() + begin, end - begin);
+            begin = end;
+
+            if( _rolling_file.IsFull(_length) )
+                Rotate();
+        }
+    }
+
+    void Rotate()
+    {
+        Close();
+        _rolling_file.Backup();
+        CountRotation();
+
+        Open();
     }
 
+private:
+    RollingFile _rolling_file;
+
+    int _fd{-1};
+    char* _mapping{nullptr};
+    size_t _length{0};
+    size_t _capacity{0};
+};
+
+/**
+ * minimal io_uring for the writes of AsyncFileAppender, driven by the raw
+ * syscalls. Init() fails where io_uring isn't built in or is refused
+ * (old kernel, seccomp), callers then write synchronously.
+ *
+ * single threaded: one writer submits and reaps.
+ */
+class IoUring
+{
 public:
-    void Stop()
+    IoUring() = default;
+    ~IoUring()
     {
-        _worker.Stop();
+        Exit();
     }
 
-    void Start()
+    IoUring(const IoUring&) = delete;
+    IoUring& operator= (const IoUring&) = delete;
+
+#ifdef LOG4CPP_HAS_IO_URING
+    bool Init(unsigned int entries)
     {
-        _worker.Start();
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        _fd = syscall(__NR_io_uring_setup, entries, &params);
+        if( _fd < 0 )
+            return false;
+
+        _sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if( single )
+            _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+
+        _sq_ring = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        _cq_ring = single ? _sq_ring
+            : mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if( _sq_ring == MAP_FAILED || _cq_ring == MAP_FAILED || sqes == MAP_FAILED ){
+            if( sqes != MAP_FAILED )
+                munmap(sqes, _sqes_size);
+            if( _cq_ring == _sq_ring )
+                _cq_ring = MAP_FAILED;
+            Exit();
+            return false;
+        }
+
+        char* sq = static_cast<char*>(_sq_ring);
+        _sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+        _sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+        _sq_mask = *reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+        _sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+        _sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+        char* cq = static_cast<char*>(_cq_ring);
+        _cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+        _cq_mask = *reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
     }
 
-    void Restart()
+    bool Available() const { return _fd >= 0; }
+
+    /**
+     * queue and submit one write of iov (kept alive by the caller).
+     * ordered writes only start once every earlier one has completed.
+     *
+     * false leaves nothing queued: an sqe the kernel didn't take is
+     * taken back, so no later enter can submit it against a buffer
+     * reused by the caller's fallback.
+     */
+    bool SubmitWrite(int fd, const struct iovec* iov, uint64_t offset, uint64_t user_data, bool ordered)
     {
-        _worker.Restart();
+        unsigned int tail = __atomic_load_n(_sq_tail, __ATOMIC_RELAXED);
+        unsigned int index = tail & _sq_mask;
+
+        struct io_uring_sqe* sqe = &_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->flags = ordered ? IOSQE_IO_DRAIN : 0;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(iov);
+        sqe->len = 1;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+
+        _sq_array[index] = index;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        int ret;
+        do{
+            ret = syscall(__NR_io_uring_enter, _fd, 1, 0, 0, nullptr, 0);
+        }while( ret < 0 && errno == EINTR );
+
+        // once consumed its completion comes, even for a failed write.
+        if( ret == 1 || __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) != tail )
+            return true;
+
+        __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
     }
 
-protected:
-    virtual void Output(const std::string& log_str) = 0;
+    // the next completion if there is one, never blocks.
+    bool PeekCompletion(uint64_t& user_data, int& result)
+    {
+        if( _fd < 0 )
+            return false;
+
+        unsigned int head = __atomic_load_n(_cq_head, __ATOMIC_RELAXED);
+        if( head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) )
+            return false;
+
+        const struct io_uring_cqe& cqe = _cqes[head & _cq_mask];
+        user_data = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // block for the next completion.
+    bool WaitCompletion(uint64_t& user_data, int& result)
+    {
+        while( true ){
+            if( PeekCompletion(user_data, result) )
+                return true;
+
+            int ret = syscall(__NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if( ret < 0 && errno != EINTR )
+                return false;
+        }
+    }
+#else
+    bool Init(unsigned int entries) { return false; }
+    bool Available() const { return false; }
+    bool SubmitWrite(int fd, const struct iovec* iov, uint64_t offset, uint64_t user_data, bool ordered) { return false; }
+    bool PeekCompletion(uint64_t& user_data, int& result) { return false; }
+    bool WaitCompletion(uint64_t& user_data, int& result) { return false; }
+#endif
 
 private:
-    std::string Format(const LogEvent& log_ev)
+    void Exit()
     {
-        return std::move(_log_formatter->Format(log_ev));
+#ifdef LOG4CPP_HAS_IO_URING
+        if( _sqes != nullptr )
+            munmap(_sqes, _sqes_size);
+        if( _cq_ring != MAP_FAILED && _cq_ring != _sq_ring )
+            munmap(_cq_ring, _cq_size);
+        if( _sq_ring != MAP_FAILED )
+            munmap(_sq_ring, _sq_size);
+        _sqes = nullptr;
+        _sq_ring = _cq_ring = MAP_FAILED;
+#endif
+        if( _fd >= 0 )
+            close(_fd);
+        _fd = -1;
     }
 
 private:
-    Work _worker;
+    int _fd{-1};
+#ifdef LOG4CPP_HAS_IO_URING
+    void* _sq_ring{MAP_FAILED};
+    void* _cq_ring{MAP_FAILED};
+    size_t _sq_size{0};
+    size_t _cq_size{0};
+    size_t _sqes_size{0};
 
-    std::shared_ptr<Log4CPP::Formatter> _log_formatter;
+    unsigned int* _sq_head{nullptr};
+    unsigned int* _sq_tail{nullptr};
+    unsigned int _sq_mask{0};
+    unsigned int* _sq_array{nullptr};
+    struct io_uring_sqe* _sqes{nullptr};
+
+    unsigned int* _cq_head{nullptr};
+    unsigned int* _cq_tail{nullptr};
+    unsigned int _cq_mask{0};
+    struct io_uring_cqe* _cqes{nullptr};
+#endif
 };
 
-class ConsoleAppender
+/**
+ * file appender whose writes complete in the background.
+ *
+ * batches are copied into one of two aligned buffers and submitted
+ * through io_uring, so the writer thread formats the next batch while
+ * the kernel writes the previous one; it only waits for the buffer it is
+ * about to reuse, and in Flush(). once the queue is drained finished
+ * writes are reaped without waiting. without io_uring, or with io_uring
+ * false, the same buffers are written with pwrite.
+ *
+ * direct_io opens the file O_DIRECT: writes then cover whole blocks, the
+ * last partial block is padded with zeros and rewritten by the next
+ * write, which the kernel starts only after the earlier ones, and the
+ * file is cut to its real length on close. a crash may leave that zero
+ * padding, it is skipped on reopen. filesystems refusing O_DIRECT get
+ * buffered writes.
+ */
+class AsyncFileAppender
     : public Appender
-    , public std::enable_shared_from_this<ConsoleAppender>
+    , public std::enable_shared_from_this<AsyncFileAppender>
 {
-private:
-    ConsoleAppender()
+    static const size_t ALIGNMENT = 4096;
+    static const size_t BUFFER_SIZE = 1024 * 1024;
+    static const int BUFFER_COUNT = 2;
+
+    struct Buffer
     {
-    }
+        char* data{nullptr};
+        size_t size{0};         // bytes to write, padding included.
+        uint64_t offset{0};
+        struct iovec iov;
+        bool in_flight{false};
+        bool overlapped{false};  // the next write covers its last block.
+    };
+
 public:
-    static std::shared_ptr<ConsoleAppender>& Get()
+    AsyncFileAppender(const char* file_path, bool direct_io = false, bool io_uring = true)
+        : _rolling_file(file_path), _direct_io(direct_io)
     {
-        static std::shared_ptr<ConsoleAppender> _instance(new ConsoleAppender);
-        return _instance;
-    }
+        for(Buffer& buffer : _buffers){
+            void* data = nullptr;
+            if( posix_memalign(&data, ALIGNMENT, BUFFER_SIZE) != 0 )
+                throw std::bad_alloc();
+            buffer.data = static_cast<char*>(data);
+        }
 
-    ~ConsoleAppender()
+        if( io_uring )
+            _ring.Init(BUFFER_COUNT);
+        Open();
+    }
+    ~AsyncFileAppender()
     {
         Stop();
+        Close();
+
+        for(Buffer& buffer : _buffers)
+            free(buffer.data);
     }
 
+    std::string Name() const override
+    {
+        return _rolling_file.Path();
+    }
+
+    // false when writes fall back to pwrite.
+    bool UsingIoUring() const { return _ring.Available(); }
+    // false when O_DIRECT was not asked for or refused.
+    bool UsingDirectIO() const { return _direct; }
+
 private:
+    bool Open()
+    {
+        const char* path = _rolling_file.Path().c_str();
+        _direct = false;
+        _length = 0;
+        _carry = 0;
+        for(Buffer& buffer : _buffers)
+            buffer.size = 0;
+
+        struct stat file_stat;
+        if( stat(path, &file_stat) == 0 )
+            _length = file_stat.st_size;
+
+        if( _direct_io ){
+            _fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | O_DIRECT, 0644);
+            _direct = _fd >= 0;
+        }
+        if( _fd < 0 )
+            _fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if( _fd < 0 ){
+            std::cerr << "fail to open file " << _rolling_file.Path() << std::endl;
+            return false;
+        }
+
+        if( _direct )
+            LoadTail(path);
+
+        return true;
+    }
+
+    /**
+     * skip the zero padding a crash may have left and keep the last
+     * partial block, the next direct write rewrites it.
+     */
+    void LoadTail(const char* path)
+    {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if( fd < 0 )
+            return;
+
+        while( _length > 0 ){
+            uint64_t block = (_length - 1) / ALIGNMENT * ALIGNMENT;
+            ssize_t len = pread(fd, _buffers[_current].data, _length - block, block);
+            if( len != static_cast<ssize_t>(_length - block) )
+                break;
+
+            size_t kept = len;
+            while( kept > 0 && _buffers[_current].data[kept - 1] == '\0' )
+                kept--;
+
+            _length = block + kept;
+            if( kept > 0 )
+                break;
+        }
+        close(fd);
+
+        _carry = _length % ALIGNMENT;
+        if( _carry != 0 && ftruncate(_fd, _length) != 0 )
+            std::cerr << "fail to truncate file " << _rolling_file.Path() << std::endl;
+    }
+
+    void Close()
+    {
+        if( _fd < 0 )
+            return;
+
+        WaitAll();
+        if( _direct && ftruncate(_fd, _length) != 0 )
+            std::cerr << "fail to truncate file " << _rolling_file.Path() << std::endl;
+
+        close(_fd);
+        _fd = -1;
+    }
+
     void Output(const std::string& log_str) override
     {
-        //std::cout << log_str << std::endl;
-        printf("%s\n", log_str.c_str());
+        Write(log_str.data(), log_str.size());
+        Write("\n", 1);
+        if( _rolling_file.IsFull(_length) )
+            Rotate();
+    }
+
+    // split where the file gets full, like FileAppender.
+    void Output(const LogBatch& batch) override
+    {
+        size_t begin = 0;
+        for(size_t index = 0; index < batch.Count(); index++){
+            size_t end = batch.RecordEnd(index);
+            if( index + 1 < batch.Count() && !_rolling_file.IsFull(_length + end - begin) )
+                continue;
+
+            Write(batch.Data() + begin, end - begin);
+            begin = end;
+
+            if( _rolling_file.IsFull(_length) )
+                Rotate();
+        }
+    }
+
+    // a short write found here is completed right away.
+    void Sync() override
+    {
+        uint64_t index;
+        int result;
+        while( _ring.PeekCompletion(index, result) )
+            Completed(_buffers[index], result);
+    }
+
+    void Flush() override
+    {
+        WaitAll();
+    }
+
+    void Rotate()
+    {
+        Close();
+        _rolling_file.Backup();
+        CountRotation();
+        Open();
+    }
+
+    void Write(const char* data, size_t len)
+    {
+        if( _fd < 0 )
+            return;
+
+        while( len > 0 ){
+            Buffer& buffer = _buffers[_current];
+            Buffer& previous = _buffers[(_current + BUFFER_COUNT - 1) % BUFFER_COUNT];
+            Wait(buffer);
+
+            // in direct mode the buffer starts with the last partial block.
+            size_t used = 0;
+            bool ordered = false;
+            if( _direct && _carry > 0 ){
+                if( &previous != &buffer && previous.size > 0 ){
+                    memcpy(buffer.data, previous.data + previous.size - ALIGNMENT, _carry);
+                    previous.overlapped = true;
+                }
+                used = _carry;
+                ordered = true;
+            }
+
+            size_t chunk = std::min(len, BUFFER_SIZE - used);
+            memcpy(buffer.data + used, data, chunk);
+            used += chunk;
+
+            buffer.offset = _length - _carry;
+            buffer.size = used;
+            if( _direct ){
+                buffer.size = (used + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+                memset(buffer.data + used, 0, buffer.size - used);
+                _carry = used % ALIGNMENT;
+            }
+
+            Submit(buffer, ordered);
+            _length += chunk;
+            data += chunk;
+            len -= chunk;
+            _current = (_current + 1) % BUFFER_COUNT;
+        }
+    }
+
+    // ordered: the write overlaps the previous one and must land after it.
+    void Submit(Buffer& buffer, bool ordered)
+    {
+        buffer.overlapped = false;
+        buffer.iov.iov_base = buffer.data;
+        buffer.iov.iov_len = buffer.size;
+        if( _ring.Available() && _ring.SubmitWrite(_fd, &buffer.iov, buffer.offset, &buffer - _buffers, ordered) ){
+            buffer.in_flight = true;
+            return;
+        }
+
+        if( ordered )
+            WaitAll();
+        WriteAt(buffer, 0);
+    }
+
+    void Wait(Buffer& buffer)
+    {
+        while( buffer.in_flight ){
+            uint64_t index;
+            int result;
+            if( !_ring.WaitCompletion(index, result) ){
+                // the ring broke, rewrite what was pending synchronously.
+                for(Buffer& pending : _buffers){
+                    if( pending.in_flight ){
+                        pending.in_flight = false;
+                        WriteAt(pending, 0);
+                    }
+                }
+                return;
+            }
+
+            Completed(_buffers[index], result);
+        }
+    }
+
+    // a short write is finished synchronously.
+    void Completed(Buffer& done, int result)
+    {
+        done.in_flight = false;
+        if( result < 0 ){
+            std::cerr << "fail to write file " << _rolling_file.Path() << ": " << strerror(-result) << std::endl;
+        }else if( static_cast<size_t>(result) < done.size ){
+            WriteAt(done, result);
+        }
+    }
+
+    void WaitAll()
+    {
+        for(Buffer& buffer : _buffers)
+            Wait(buffer);
+    }
+
+    /**
+     * synchronous write of the buffer from done on. O_DIRECT restarts at
+     * the block done falls in, the buffer and its offset are aligned. a
+     * last block the next write already covers isn't written again, it
+     * would put older bytes over it.
+     */
+    void WriteAt(Buffer& buffer, size_t done)
+    {
+        size_t end = buffer.overlapped ? buffer.size - ALIGNMENT : buffer.size;
+        while( done < end ){
+            if( _direct )
+                done = done / ALIGNMENT * ALIGNMENT;
+
+            ssize_t len = pwrite(_fd, buffer.data + done, end - done, buffer.offset + done);
+            if( len < 0 && errno == EINTR )
+                continue;
+            if( len <= 0 ){
+                std::cerr << "fail to write file " << _rolling_file.Path() << std::endl;
+                return;
+            }
+            done += len;
+        }
     }
+
+private:
+    RollingFile _rolling_file;
+    bool _direct_io;
+    bool _direct{false};
+    int _fd{-1};
+
+    IoUring _ring;
+    Buffer _buffers[BUFFER_COUNT];
+    int _current{0};
+
+    uint64_t _length{0};    // bytes of log in the file.
+    size_t _carry{0};       // bytes of the last partial block, direct mode.
 };
 
-class FileAppender
-    : public Appender
-    , public std::enable_shared_from_this<FileAppender>
+/**
+ * layout of the files written by BinaryFileAppender, version 1.
+ *
+ * a file is a sequence of segments, each one opened by MAGIC and VERSION
+ * and followed by records. a new segment resets the string table and
+ * the timestamp base, it starts every file and every reopen.
+ *
+ * record: varint body length, then the body:
+ *   STRING  u8 type, varint id, the bytes (rest of the body)
+ *   EVENT   u8 type, u8 flags, varint zigzag microseconds since the
+ *           previous event of the segment, varint tid, u8 level,
+ *           varint module id,
+ *           DEFERRED ? varint format id, varint size, LogArgs bytes
+ *                    : varint size, text,
+ *           [NAME: varint thread name id] [CONTEXT: varint size, text]
+ *           [FIELDS: varint size, LogArgs bytes]
+ *
+ * string ids are defined by a STRING record before their first use. a
+ * crash can only leave the last record torn, readers stop there and the
+ * appender cuts it off when it reopens the file.
+ */
+class BinaryFormat
 {
+    BinaryFormat();
 public:
-    /**
-     * file_path:
-     * file_count: max log file count.
-     * max_size_per_file: max size on MB per log file.
-     */
-    FileAppender(const char* file_path)
+    static constexpr const char* MAGIC = "L4CB";
+    static const size_t MAGIC_SIZE = 4;
+    static const uint8_t VERSION = 1;
+
+    enum Record : uint8_t
     {
-        _file_path.assign(Configure::Instance().GetDirectory());
-        _file_path.append(file_path);
+        EVENT = 1,
+        STRING = 2
+    };
+
+    enum Flag : uint8_t
+    {
+        DEFERRED = 1,
+        NAME = 2,
+        CONTEXT = 4,
+        FIELDS = 8
+    };
+
+    static void PutVarint(LogBuffer& out, uint64_t value)
+    {
+        char bytes[10];
+        size_t len = 0;
+        while( value >= 0x80 ){
+            bytes[len++] = static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        bytes[len++] = static_cast<char>(value);
+
+        out.Append(bytes, len);
+    }
+
+    // false when the varint runs past end.
+    static bool GetVarint(const char*& pos, const char* end, uint64_t& value)
+    {
+        value = 0;
+        for(int shift = 0; pos < end && shift < 64; shift += 7){
+            uint8_t byte = static_cast<uint8_t>(*pos++);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if( (byte & 0x80) == 0 )
+                return true;
+        }
+
+        return false;
+    }
+
+    static uint64_t ZigZag(int64_t value)
+    {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+    static int64_t UnZigZag(uint64_t value)
+    {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    // bytes of data starting with a complete segment header.
+    static bool IsHeader(const char* data, size_t size)
+    {
+        return size >= MAGIC_SIZE + 1 && memcmp(data, MAGIC, MAGIC_SIZE) == 0;
+    }
+};
+
+/**
+ * appender writing the compact BinaryFormat instead of text, decoded
+ * offline by tools/log4cpp-decode.
+ *
+ * module names, deferred formats and thread names are written once per
+ * file into a string table, arguments and fields in their raw LogArgs
+ * encoding, so no text is formatted at all. rotation is decided while
+ * encoding, so every file holds its own string table.
+ */
+class BinaryFileAppender
+    : public Appender
+    , public std::enable_shared_from_this<BinaryFileAppender>
+{
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    static const size_t STRING_CACHE_SIZE = 64;
+
+    // last address seen per cache slot, text points into _strings.
+    struct CachedString
+    {
+        const char* str{nullptr};
+        const std::string* text{nullptr};
+        uint64_t id{0};
+    };
 
+public:
+    BinaryFileAppender(const char* file_path) : _rolling_file(file_path)
+    {
         Open();
     }
-    ~FileAppender()
+    ~BinaryFileAppender()
     {
         Stop();
         Close();
     }
 
+    std::string Name() const override
+    {
+        return _rolling_file.Path();
+    }
+
 private:
     bool Open()
     {
-        _file_buffer.open(_file_path, std::ios::app);
-        if( !_file_buffer ){
-            std::cerr << "fail to open file " << _file_path << std::endl;
+        unsigned long size = RecoverTail();
+
+        _file.open(_rolling_file.Path(), std::ios::app | std::ios::binary);
+        if( !_file ){
+            std::cerr << "fail to open file " << _rolling_file.Path() << std::endl;
             return false;
         }
 
+        _size = size;
+        _segment = true;
         return true;
     }
+
     void Close()
     {
-        if( _file_buffer ){
-            _file_buffer.flush();
-            _file_buffer.clear();
-            _file_buffer.close();
+        if( _file ){
+            _file.flush();
+            _file.clear();
+            _file.close();
         }
     }
 
-    void Output(const std::string& log_str) override
+    /**
+     * cut a record torn by a crash off the end of an existing file,
+     * return the size kept.
+     *
+     * only record lengths are read, a chunk at a time, the bodies are
+     * skipped.
+     */
+    unsigned long RecoverTail()
     {
-        //std::cout << log_str << std::endl;
-        _file_buffer << log_str << std::endl;
+        int fd = open(_rolling_file.Path().c_str(), O_RDONLY | O_CLOEXEC);
+        if( fd < 0 )
+            return 0;
 
-        if( IsFull() ){
-            Close();
-            Backup();
+        struct stat file_stat;
+        uint64_t size = fstat(fd, &file_stat) == 0 ? file_stat.st_size : 0;
+        std::unique_ptr<char[]> chunk(new char[CHUNK_SIZE]);
 
-            Open();
+        // chunk holds the file's bytes [window, window + got).
+        uint64_t window = 0, offset = 0, valid = 0;
+        size_t got = 0;
+        while( offset < size ){
+            // a segment header or a length varint fits in 16 bytes.
+            if( offset + 16 > window + got && window + got < size ){
+                size_t want = size - offset < CHUNK_SIZE ? size - offset : CHUNK_SIZE;
+                ssize_t count = pread(fd, chunk.get(), want, offset);
+                if( count <= 0 )
+                    break;
+                window = offset;
+                got = count;
+            }
+
+            const char* pos = chunk.get() + (offset - window);
+            const char* end = chunk.get() + got;
+            if( BinaryFormat::IsHeader(pos, end - pos) ){
+                offset += BinaryFormat::MAGIC_SIZE + 1;
+                valid = offset;
+                continue;
+            }
+
+            uint64_t length;
+            if( !BinaryFormat::GetVarint(pos, end, length) )
+                break;
+            uint64_t record_end = window + (pos - chunk.get()) + length;
+            if( record_end > size )
+                break;
+            offset = valid = record_end;
         }
+        close(fd);
+
+        if( valid != size && truncate(_rolling_file.Path().c_str(), valid) != 0 )
+            std::cerr << "fail to truncate file " << _rolling_file.Path() << std::endl;
+
+        return valid;
     }
 
-    bool IsFull()
+    void Format(const LogEvent& e, LogBatch& batch) override
     {
-        if( Configure::Instance().GetBackupCount() ==  0 )
-            return false;
+        LogBuffer& out = batch.BeginRecord();
+        size_t record_begin = out.Size();
+
+        if( _segment ){
+            out.Append(BinaryFormat::MAGIC, BinaryFormat::MAGIC_SIZE);
+            out.Append(static_cast<char>(BinaryFormat::VERSION));
+            _strings.clear();
+            for(CachedString& cached : _string_cache)
+                cached = CachedString();
+            _next_string_id = 1;
+            _last_timestamp = 0;
+            _segment = false;
+        }
+
+        uint64_t module = Intern(e.Module(), strlen(e.Module()), out);
+        uint64_t format = e.Deferred() ? Intern(e.FormatString(), strlen(e.FormatString()), out) : 0;
+        uint64_t name = e.ThreadName().empty() ? 0 : Intern(e.ThreadName().data(), e.ThreadName().size(), out);
+
+        uint8_t flags = 0;
+        if( e.Deferred() ) flags |= BinaryFormat::DEFERRED;
+        if( name != 0 ) flags |= BinaryFormat::NAME;
+        if( !e.Context().empty() ) flags |= BinaryFormat::CONTEXT;
+        if( !e.Fields().Empty() ) flags |= BinaryFormat::FIELDS;
+
+        int64_t timestamp = static_cast<int64_t>(e.Timestamp().tv_sec) * 1000000 + e.Timestamp().tv_usec;
+
+        _body.Clear();
+        _body.Append(static_cast<char>(BinaryFormat::EVENT));
+        _body.Append(static_cast<char>(flags));
+        BinaryFormat::PutVarint(_body, BinaryFormat::ZigZag(timestamp - _last_timestamp));
+        BinaryFormat::PutVarint(_body, static_cast<unsigned int>(e.ThreadID()));
+        _body.Append(static_cast<char>(e.LogLevel()));
+        BinaryFormat::PutVarint(_body, module);
+        if( e.Deferred() ){
+            BinaryFormat::PutVarint(_body, format);
+            PutBytes(_body, e.Args().Data(), e.Args().Size());
+        }else{
+            PutBytes(_body, e.Text().data(), e.Text().size());
+        }
+        if( name != 0 )
+            BinaryFormat::PutVarint(_body, name);
+        if( flags & BinaryFormat::CONTEXT )
+            PutBytes(_body, e.Context().data(), e.Context().size());
+        if( flags & BinaryFormat::FIELDS )
+            PutBytes(_body, e.Fields().Data(), e.Fields().Size());
+
+        BinaryFormat::PutVarint(out, _body.Size());
+        out.Append(_body.Data(), _body.Size());
+        batch.EndRecord(false);
+        _last_timestamp = timestamp;
 
-        return static_cast<unsigned long>(_file_buffer.tellp()) >= Configure::Instance().GetLogFileMaxSize() * 1024 * 1024;
+        // the file rotates after this record, the next one opens a segment.
+        _size += out.Size() - record_begin;
+        if( _rolling_file.IsFull(_size) ){
+            _rotate_after.push_back(batch.Count() - 1);
+            _size = 0;
+            _segment = true;
+        }
     }
 
-    void Backup()
+    /**
+     * the id of str, defined by a STRING record on first use.
+     *
+     * keyed by content, so a string rebuilt at a new address (thread
+     * names are, on every ThreadContext change) keeps its id. a small
+     * cache by address saves the hashing for the usual static strings.
+     */
+    uint64_t Intern(const char* str, size_t len, LogBuffer& out)
     {
-        for(int index = Configure::Instance().GetBackupCount(); index > 0; index--){
-            const std::string& src_log_file = ConstructLogFilePath(index - 1);
-            const std::string& des_log_file = ConstructLogFilePath(index);
-
-            // delete old bak log file.
-            remove(des_log_file.c_str());
+        CachedString& cached = _string_cache[(reinterpret_cast<uintptr_t>(str) >> 3) % STRING_CACHE_SIZE];
+        if( cached.str == str && cached.text->size() == len && memcmp(cached.text->data(), str, len) == 0 )
+            return cached.id;
 
-            struct stat file_stat;
-            if( stat(src_log_file.c_str(), &file_stat ) == 0 ){
-                rename(src_log_file.c_str(), des_log_file.c_str());
-            }
+        auto iter = _strings.find(std::string(str, len));
+        if( iter != _strings.end() ){
+            cached.str = str;
+            cached.text = &iter->first;
+            cached.id = iter->second;
+            return iter->second;
         }
 
-        // delete primary log file.
-        remove(_file_path.c_str());
+        uint64_t id = _next_string_id++;
+        iter = _strings.emplace(std::string(str, len), id).first;
+        cached.str = str;
+        cached.text = &iter->first;
+        cached.id = id;
+
+        _body.Clear();
+        _body.Append(static_cast<char>(BinaryFormat::STRING));
+        BinaryFormat::PutVarint(_body, id);
+        _body.Append(str, len);
+
+        BinaryFormat::PutVarint(out, _body.Size());
+        out.Append(_body.Data(), _body.Size());
+        return id;
     }
 
-    std::string ConstructLogFilePath(int index)
+    static void PutBytes(LogBuffer& out, const char* data, size_t size)
     {
-        std::string file_path(_file_path);
-        if( index > 0 )
-            file_path.append(".").append(std::to_string(index));
+        BinaryFormat::PutVarint(out, size);
+        out.Append(data, size);
+    }
 
-        return file_path;
+    // records are not lines, write them as they are.
+    void Output(const std::string& log_str) override
+    {
+        _file.write(log_str.data(), log_str.size());
+        _file.flush();
+    }
+
+    void Output(const LogBatch& batch) override
+    {
+        size_t begin = 0;
+        size_t rotation = 0;
+        for(size_t index = 0; index < batch.Count(); index++){
+            bool rotate = rotation < _rotate_after.size() && _rotate_after[rotation] == index;
+            if( index + 1 < batch.Count() && !rotate )
+                continue;
+
+            size_t end = batch.RecordEnd(index);
+            _file.write(batch.Data() + begin, end - begin);
+            _file.flush();
+            begin = end;
+
+            if( rotate ){
+                rotation++;
+                Close();
+                _rolling_file.Backup();
+                CountRotation();
+                _file.open(_rolling_file.Path(), std::ios::app | std::ios::binary);
+            }
+        }
+
+        _rotate_after.clear();
     }
 
 private:
-    std::ofstream _file_buffer;
-    std::string _file_path;
-};
+    std::ofstream _file;
+    RollingFile _rolling_file;
 
+    // writer thread only: the segment being encoded.
+    bool _segment{true};
+    unsigned long _size{0};
+    int64_t _last_timestamp{0};
+    std::unordered_map<std::string, uint64_t> _strings;
+    CachedString _string_cache[STRING_CACHE_SIZE];
+    uint64_t _next_string_id{1};
+    LogBuffer _body;
+    std::vector<size_t> _rotate_after;
+};
 
 class Logger;
+
+/**
+ * builds one log line from << items and Kv fields.
+ *
+ * Endl flushes the line; whatever is still pending when the statement
+ * ends is flushed by the destructor, e.g. logger->Info().Kv("user", id).
+ *
+ * NOTE:
+ * until fields came, a stream without Endl logged nothing; it now logs
+ * its pending items at the end of the statement. a failure there (out of
+ * memory) drops the line rather than throwing from the destructor.
+ */
 class LogStream
 {
 public:
     LogStream(Logger *ptr, const Level level) : _logger_ptr(ptr), _level(level)
     {
     }
+    LogStream(LogStream&& other)
+        : _logger_ptr(other._logger_ptr), _level(other._level)
+        , _log_items(std::move(other._log_items)), _fields(std::move(other._fields))
+    {
+        other._log_items.clear();
+        other._fields = LogArgs();
+    }
+    ~LogStream()
+    {
+        if( _log_items.empty() && _fields.Empty() )
+            return;
+
+        try{
+            Flush();
+        }catch(...){
+        }
+    }
 
 public:
     void Flush();
+
+    // a typed field, kept apart from the text for structured formatters.
+    template<typename T>
+    LogStream& Kv(const char* key, const T& value)
+    {
+        _fields.Add(key);
+        _fields.Add(value);
+        return *this;
+    }
+
     LogStream& operator<< (LogStream& (*pf)(LogStream&))
     {
         return (*pf)(*this);
@@ -609,6 +5032,7 @@ private:
     Logger* _logger_ptr{nullptr};
     Level _level;
     std::vector<std::string> _log_items;    
+    LogArgs _fields;
 };
 
 inline LogStream& Endl(LogStream& stream)
@@ -617,26 +5041,118 @@ inline LogStream& Endl(LogStream& stream)
     return stream;
 }
 
+/**
+ * loggers form a tree by their dotted names: "db.pool" is the parent of
+ * "db.pool.conn". a logger without a level of its own takes its parent's,
+ * and by default also hands its events to its ancestors' appenders.
+ */
 class Logger
     : public std::enable_shared_from_this<Logger>
 {
     friend class LogStream;
+    friend class LoggerManager;
+
+    // appenders one event is dispatched to without allocating.
+    static const size_t INLINE_TARGETS = 8;
+public:
+    typedef std::vector<std::shared_ptr<Appender>> AppenderList;
 private:
-    Logger(const char* name) : _log_name(name)
+    Logger(const std::string& name) : _log_name(name)
     {
     }
 public:
     ~Logger()
     {
+        delete _log_appender_list.load();
         //std::cout<< "destruct [" << _log_name << "] logger." << std::endl;
     }
 
 public:
-    static std::shared_ptr<Logger> GetLogger(const char* module_name);
+    /**
+     * the logger of module_name, created on first use. safe from any
+     * thread; a lookup of an existing logger takes no lock and, given a
+     * string_view, doesn't allocate.
+     */
+    static std::shared_ptr<Logger> GetLogger(const char* module_name)
+    {
+        return GetLogger(module_name, strlen(module_name));
+    }
+    static std::shared_ptr<Logger> GetLogger(const std::string& module_name)
+    {
+        return GetLogger(module_name.data(), module_name.size());
+    }
+#if __cplusplus >= 201703L
+    static std::shared_ptr<Logger> GetLogger(std::string_view module_name)
+    {
+        return GetLogger(module_name.data(), module_name.size());
+    }
+#endif
+    static std::shared_ptr<Logger> GetLogger(const char* module_name, size_t len);
+
+    const std::string& GetName() const { return _log_name; }
 
+    /**
+     * the appender list is copied on change and published whole, loggers
+     * in use keep logging through the old list meanwhile.
+     */
     void AddAppender(std::shared_ptr<Appender> appender)
     {
-        _log_appender_list.push_back(appender);
+        std::lock_guard<std::mutex> lock(AppenderMutex());
+        AppenderList* list = new AppenderList(*_log_appender_list.load());
+        list->push_back(appender);
+        PublishAppenders(list);
+    }
+    void SetAppenders(const AppenderList& appenders)
+    {
+        std::lock_guard<std::mutex> lock(AppenderMutex());
+        PublishAppenders(new AppenderList(appenders));
+    }
+    AppenderList GetAppenders() const
+    {
+        ReadCopyUpdate::Guard guard(AppenderRcu());
+        return *_log_appender_list.load();
+    }
+
+    /**
+     * level of this logger and of the descendants without their own, the
+     * global lowest level still applies on top of it.
+     */
+    void SetLevel(const Level& level);
+    // inherit the parent's level again.
+    void ResetLevel();
+    // own or inherited level.
+    Level GetLevel() const
+    {
+        return static_cast<Level>(_level.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * whether events also go to the ancestors' appenders, true by
+     * default like log4j's additivity.
+     */
+    void SetAdditivity(bool additive)
+    {
+        _additive.store(additive, std::memory_order_relaxed);
+    }
+    bool GetAdditivity() const { return _additive.load(std::memory_order_relaxed); }
+
+    std::shared_ptr<Logger> GetParent() const { return _parent; }
+
+    /**
+     * one relaxed load and compare, cheap enough to guard every log
+     * statement before any formatting work.
+     */
+    bool IsEnabled(const Level level) const
+    {
+        return static_cast<int>(level) >= _effective_level.load(std::memory_order_relaxed);
+    }
+
+    // recompute the effective level from this logger's and the global level.
+    void RefreshLevel()
+    {
+        int level_t = _level.load(std::memory_order_relaxed);
+        int lowest_level_t = static_cast<int>(Configure::Instance().GetLowestLevel());
+        _effective_level.store(std::max(level_t, lowest_level_t), std::memory_order_relaxed);
     }
 
     void Debug(const char* log)
@@ -660,6 +5176,41 @@ public:
         Append(Level::FATAL, log);
     }
 
+    /**
+     * deferred formatting: only the raw arguments are copied here, the
+     * "{}" placeholders of format are filled on the writer thread.
+     *
+     * format must be a string literal, see LogFormat. the caller still
+     * pays for the timestamp, the thread tag and the queue push: about
+     * 300ns p50 per line in bench (one file appender), against about 1us
+     * for the printf style LOG_* macros.
+     */
+    template<typename Arg, typename... Args>
+    void Debug(const LogFormat& format, const Arg& arg, const Args&... args)
+    {
+        Append(Level::DEBUG, format, arg, args...);
+    }
+    template<typename Arg, typename... Args>
+    void Info(const LogFormat& format, const Arg& arg, const Args&... args)
+    {
+        Append(Level::INFO, format, arg, args...);
+    }
+    template<typename Arg, typename... Args>
+    void Warn(const LogFormat& format, const Arg& arg, const Args&... args)
+    {
+        Append(Level::WARN, format, arg, args...);
+    }
+    template<typename Arg, typename... Args>
+    void Error(const LogFormat& format, const Arg& arg, const Args&... args)
+    {
+        Append(Level::ERROR, format, arg, args...);
+    }
+    template<typename Arg, typename... Args>
+    void Fatal(const LogFormat& format, const Arg& arg, const Args&... args)
+    {
+        Append(Level::FATAL, format, arg, args...);
+    }
+
     LogStream Debug()
     {
         return LogStream(this, Level::DEBUG);
@@ -682,44 +5233,179 @@ public:
     }
 
 private:
-    void Append(const Level level, const char* log)
+    void Append(const Level level, const char* log, LogArgs&& fields = LogArgs())
     {
         // permit this level log.
         if( !Allow(level) )
             return;
 
         LogEvent e(Utility::CurrentThreadID(), _log_name.c_str(), level, log);
+        e.SetThreadTag(ThreadContext::Tag());
+        if( !fields.Empty() )
+            e.SetFields(std::move(fields));
 
-        for(auto& appender : _log_appender_list)
-            appender->Append(e);
+        Dispatch(e);
     }
 
-    bool Allow(const Level level)
+    template<typename Arg, typename... Args>
+    void Append(const Level level, const LogFormat& format, const Arg& arg, const Args&... args)
     {
-        const Level& lowest_level = Configure::Instance().GetLowestLevel();
-        if( lowest_level == Level::OFF )
-            return false;
+        if( !Allow(level) )
+            return;
 
-        if( lowest_level == Level::ALL )
-            return true;
+        LogEvent e(Utility::CurrentThreadID(), _log_name.c_str(), level, format, arg, args...);
+        e.SetThreadTag(ThreadContext::Tag());
+
+        Dispatch(e);
+    }
+
+    /**
+     * to this logger's appenders, then up the tree while additive. with
+     * more than one appender, e moves into a SharedEvent and the queues
+     * get handles to it.
+     *
+     * the appenders are referenced and the guard released before posting:
+     * a blocking Post would otherwise stall every change of appenders.
+     */
+    void Dispatch(LogEvent& e)
+    {
+        std::shared_ptr<Appender> targets[INLINE_TARGETS];
+        std::vector<std::shared_ptr<Appender>> more_targets;
+        size_t count = 0;
+        {
+            ReadCopyUpdate::Guard guard(AppenderRcu());
+            for(Logger* logger = this; logger != nullptr; logger = logger->Next()){
+                for(auto& appender : *logger->_log_appender_list.load(std::memory_order_acquire)){
+                    if( count < INLINE_TARGETS )
+                        targets[count] = appender;
+                    else
+                        more_targets.push_back(appender);
+                    count++;
+                }
+            }
+        }
+
+        LogEvent handle;
+        if( count > 1 )
+            handle = LogEvent(std::make_shared<SharedEvent>(std::move(e)));
+        const LogEvent& posted = count > 1 ? handle : e;
+
+        for(size_t index = 0; index < count && index < INLINE_TARGETS; index++)
+            targets[index]->Append(posted);
+        for(auto& appender : more_targets)
+            appender->Append(posted);
+    }
+
+    // the parent, if events go on up.
+    Logger* Next() const
+    {
+        return _additive.load(std::memory_order_relaxed) ? _parent.get() : nullptr;
+    }
+
+    // with AppenderMutex() held.
+    void PublishAppenders(AppenderList* list)
+    {
+        AppenderList* old = _log_appender_list.exchange(list);
+        AppenderRcu().Synchronize();
+        delete old;
+    }
+
+    // shared by all loggers, changing appenders is rare.
+    static ReadCopyUpdate& AppenderRcu()
+    {
+        static ReadCopyUpdate _rcu;
+        return _rcu;
+    }
+    static std::mutex& AppenderMutex()
+    {
+        static std::mutex _mtx;
+        return _mtx;
+    }
+
+    /**
+     * resolve the level from the parent and pass it down to the children
+     * that inherit it. with the registry's writer lock held.
+     */
+    void Propagate()
+    {
+        int level_t = static_cast<int>(Level::ALL);
+        if( _has_level )
+            level_t = static_cast<int>(_own_level);
+        else if( _parent )
+            level_t = _parent->_level.load(std::memory_order_relaxed);
+
+        _level.store(level_t, std::memory_order_relaxed);
+        RefreshLevel();
+
+        for(auto iter = _children.begin(); iter != _children.end(); ){
+            std::shared_ptr<Logger> child = iter->lock();
+            if( !child ){
+                iter = _children.erase(iter);
+                continue;
+            }
+
+            if( !child->_has_level )
+                child->Propagate();
+            ++iter;
+        }
+    }
 
-        int level_t = static_cast<int>(level);
-        int _level_t = static_cast<int>(lowest_level);
-        return level_t >= _level_t;
+    // ALL sorts below and OFF above every real level.
+    bool Allow(const Level level)
+    {
+        return IsEnabled(level);
     }
 
 private:
     std::string _log_name;
-    
-    std::vector<std::shared_ptr<Appender>> _log_appender_list;
+    std::atomic<int> _level{static_cast<int>(Level::ALL)};
+    std::atomic<int> _effective_level{static_cast<int>(Level::ALL)};
+    std::atomic<bool> _additive{true};
+
+    // the tree, changed with the registry's writer lock held.
+    std::shared_ptr<Logger> _parent;
+    std::vector<std::weak_ptr<Logger>> _children;
+    bool _has_level{false};
+    Level _own_level{Level::ALL};
+
+    std::atomic<AppenderList*> _log_appender_list{new AppenderList};
 };
 
+/**
+ * registry of the loggers by name.
+ *
+ * the loggers live in an immutable open addressing table: lookups read
+ * the published table without locking, an insert copies it under the
+ * writers' mutex, publishes the copy and frees the old one once no
+ * reader can see it any more.
+ */
 class LoggerManager
 {
+    struct Entry
+    {
+        size_t hash{0};
+        std::shared_ptr<Logger> logger;
+    };
+
+    // power of two slots, at most half of them used.
+    struct Table
+    {
+        std::vector<Entry> slots;
+        size_t count{0};
+    };
+
 private:
-    LoggerManager() = default;
+    LoggerManager() : _table(new Table)
+    {
+        _table.load()->slots.resize(16);
+    }
 
 public:
+    ~LoggerManager()
+    {
+        delete _table.load();
+    }
+
     static LoggerManager& Instance()
     {
         static LoggerManager _instance;
@@ -729,45 +5415,214 @@ public:
 public:
     void Clear()
     {
-        _logger_list.clear();
+        std::lock_guard<std::mutex> lock(_write_mtx);
+        Table* table = new Table;
+        table->slots.resize(16);
+        Publish(table);
     }
 
+    // keeps the logger already registered under the name, if any.
     void Register(const std::string& logger_name, std::shared_ptr<Logger> logger)
     {
-        if( _logger_list.count(logger_name) == 0 )
-            _logger_list[logger_name] = logger;
+        std::lock_guard<std::mutex> lock(_write_mtx);
+        Insert(logger_name.data(), logger_name.size(), logger);
     }
 
-    std::shared_ptr<Logger> Query(const std::string& logger_name) const
+    std::shared_ptr<Logger> Query(const std::string& logger_name)
     {
-        auto iter = _logger_list.find(logger_name);
-        if( iter == _logger_list.end() )
-            return std::shared_ptr<Logger>();
+        return Query(logger_name.data(), logger_name.size());
+    }
+
+    std::shared_ptr<Logger> Query(const char* name, size_t len)
+    {
+        ReadCopyUpdate::Guard guard(_rcu);
+        const Entry* entry = Find(*_table.load(), name, len, Hash(name, len));
+        return entry->logger;
+    }
+
+    // the logger of name, created with its ancestors if missing.
+    std::shared_ptr<Logger> QueryOrCreate(const char* name, size_t len)
+    {
+        std::shared_ptr<Logger> logger = Query(name, len);
+        if( logger )
+            return logger;
+
+        const char* dot = static_cast<const char*>(memrchr(name, '.', len));
+        if( dot != nullptr )
+            QueryOrCreate(name, dot - name);
+
+        std::lock_guard<std::mutex> lock(_write_mtx);
+        return Insert(name, len, std::shared_ptr<Logger>(new Logger(std::string(name, len))));
+    }
+
+    // set or, with inherit, drop the level of logger and update its subtree.
+    void UpdateLevel(Logger& logger, Level level, bool inherit)
+    {
+        std::lock_guard<std::mutex> lock(_write_mtx);
+        logger._has_level = !inherit;
+        logger._own_level = level;
+        logger.Propagate();
+    }
+
+    /**
+     * metrics of every appender of the registered loggers, each appender
+     * once.
+     */
+    std::vector<AppenderMetrics> SnapshotMetrics()
+    {
+        std::vector<AppenderMetrics> metrics;
+        std::set<const Appender*> seen;
+        ReadCopyUpdate::Guard guard(_rcu);
+        for(auto& entry : _table.load()->slots ){
+            if( !entry.logger )
+                continue;
 
-        return iter->second;
+            for(auto& appender : entry.logger->GetAppenders() ){
+                if( seen.insert(appender.get()).second )
+                    metrics.push_back(appender->GetMetrics());
+            }
+        }
+
+        return metrics;
+    }
+
+    void RefreshLevels()
+    {
+        std::lock_guard<std::mutex> lock(_write_mtx);
+        for(auto& entry : _table.load()->slots ){
+            if( entry.logger )
+                entry.logger->RefreshLevel();
+        }
     }
 
     void ShowLoggers()
     {
-        for(auto iter : _logger_list )
-            std::cout << "logger: " << iter.first << std::endl;
+        std::set<std::string> names;
+        {
+            ReadCopyUpdate::Guard guard(_rcu);
+            for(auto& entry : _table.load()->slots ){
+                if( entry.logger )
+                    names.insert(entry.logger->GetName());
+            }
+        }
+
+        for(auto& name : names )
+            std::cout << "logger: " << name << std::endl;
+    }
+
+private:
+    // FNV-1a.
+    static size_t Hash(const char* name, size_t len)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for(size_t index = 0; index < len; index++){
+            hash ^= static_cast<unsigned char>(name[index]);
+            hash *= 1099511628211ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+
+    // the slot of name, or the empty slot ending its probe sequence.
+    static const Entry* Find(const Table& table, const char* name, size_t len, size_t hash)
+    {
+        size_t mask = table.slots.size() - 1;
+        for(size_t index = hash & mask; ; index = (index + 1) & mask){
+            const Entry& entry = table.slots[index];
+            if( !entry.logger )
+                return &entry;
+
+            const std::string& entry_name = entry.logger->GetName();
+            if( entry.hash == hash && entry_name.size() == len && memcmp(entry_name.data(), name, len) == 0 )
+                return &entry;
+        }
+    }
+
+    static Entry& EmptySlot(Table& table, size_t hash)
+    {
+        size_t mask = table.slots.size() - 1;
+        size_t index = hash & mask;
+        while( table.slots[index].logger )
+            index = (index + 1) & mask;
+        return table.slots[index];
+    }
+
+    // writers only.
+    std::shared_ptr<Logger> Insert(const char* name, size_t len, std::shared_ptr<Logger> logger)
+    {
+        const Table& current = *_table.load();
+        size_t hash = Hash(name, len);
+        const Entry* found = Find(current, name, len, hash);
+        if( found->logger )
+            return found->logger;
+
+        size_t capacity = current.slots.size();
+        if( (current.count + 1) * 2 > capacity )
+            capacity *= 2;
+
+        Table* table = new Table;
+        table->slots.resize(capacity);
+        for(auto& entry : current.slots ){
+            if( entry.logger )
+                EmptySlot(*table, entry.hash) = entry;
+        }
+        Entry& slot = EmptySlot(*table, hash);
+        slot.hash = hash;
+        slot.logger = logger;
+        table->count = current.count + 1;
+        Link(current, *logger);
+
+        Publish(table);
+        return logger;
+    }
+
+    // hang a new logger under its closest registered ancestor.
+    void Link(const Table& table, Logger& logger)
+    {
+        const std::string& name = logger.GetName();
+        for(size_t len = name.rfind('.'); len != std::string::npos && len > 0; len = name.rfind('.', len - 1)){
+            const Entry* parent = Find(table, name.data(), len, Hash(name.data(), len));
+            if( parent->logger ){
+                logger._parent = parent->logger;
+                parent->logger->_children.push_back(logger.shared_from_this());
+                break;
+            }
+        }
+
+        logger.Propagate();
+    }
+
+    void Publish(Table* table)
+    {
+        Table* old = _table.exchange(table);
+        _rcu.Synchronize();
+        delete old;
     }
 
 private:
-    std::map<std::string, std::shared_ptr<Logger>> _logger_list;
+    std::atomic<Table*> _table;
+    ReadCopyUpdate _rcu;
+    std::mutex _write_mtx;
 };
 
-inline std::shared_ptr<Logger> Logger::GetLogger(const char* module_name)
+inline std::shared_ptr<Logger> Logger::GetLogger(const char* module_name, size_t len)
 {
-    LoggerManager& manager = LoggerManager::Instance();
+    return LoggerManager::Instance().QueryOrCreate(module_name, len);
+}
 
-    std::shared_ptr<Logger> logger = manager.Query(module_name);
-    if( !logger ){
-        logger.reset(new Logger(module_name));
-        manager.Register(module_name, logger);
-    }
+inline void Logger::SetLevel(const Level& level)
+{
+    LoggerManager::Instance().UpdateLevel(*this, level, false);
+}
 
-    return logger;
+inline void Logger::ResetLevel()
+{
+    LoggerManager::Instance().UpdateLevel(*this, Level::ALL, true);
+}
+
+inline void Configure::SetLowestLevel(const Level& level)
+{
+    _lowest_level = level;
+    LoggerManager::Instance().RefreshLevels();
 }
 
 inline void LogStream::Flush()
@@ -776,7 +5631,9 @@ inline void LogStream::Flush()
     for(const auto& item : _log_items )
         log_line.append(item);
 
-    _logger_ptr->Append(_level, log_line.c_str());
+    _logger_ptr->Append(_level, log_line.c_str(), std::move(_fields));
+    _log_items.clear();
+    _fields = LogArgs();
 }
 
 } // end namespace
@@ -0,0 +1,511 @@
+/**
+ * Light weight log lib for c++.
+ *
+ * logconfig.h
+ *
+ * levels, appenders, formatters and rotation from a file, reloaded
+ * while logging goes on.
+ */
+
+#ifndef _LOG4CPP_CONFIG_H_
+#define _LOG4CPP_CONFIG_H_
+
+#include <sys/inotify.h>
+#include <poll.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include <fstream>
+
+#include "log4cpp.h"
+
+namespace Log4CPP
+{
+/**
+ * one parsed configuration file, never changed once built.
+ *
+ * the file holds "key = value" lines, '#' starts a comment:
+ *
+ *   lowest_level = INFO
+ *   backup_count = 2
+ *   max_file_size = 3          # MB
+ *   backup_compress = false
+ *
+ *   appender.main = file app.log       # console, file, mmap, async, binary
+ *   appender.main.formatter = pattern %d{%H:%M:%S} %p %c %m
+ *   appender.out = console             # formatter console, file, json, pattern
+ *
+ *   logger.db = WARN, main             # level, then appenders
+ *   logger.db.pool = , out             # no level: inherited
+ *
+ * keys left out take their defaults.
+ */
+struct ConfigSnapshot
+{
+    struct AppenderSpec
+    {
+        std::string type;
+        std::string path;
+        std::string formatter;
+        std::string pattern;
+
+        // same type and file, the appender can be kept.
+        bool SameTarget(const AppenderSpec& other) const
+        {
+            return type == other.type && path == other.path;
+        }
+        bool SameFormatter(const AppenderSpec& other) const
+        {
+            return formatter == other.formatter && pattern == other.pattern;
+        }
+    };
+
+    struct LoggerSpec
+    {
+        bool has_level{false};
+        Level level{Level::ALL};
+        std::vector<std::string> appenders;
+    };
+
+    Level lowest_level{Level::ALL};
+    unsigned int backup_count{0};
+    unsigned int max_file_size{3};
+    bool backup_compress{false};
+
+    std::map<std::string, AppenderSpec> appenders;
+    std::map<std::string, LoggerSpec> loggers;
+
+    /**
+     * throw std::invalid_argument naming the bad line. every value is
+     * checked here, a parsed snapshot always applies.
+     */
+    static std::shared_ptr<const ConfigSnapshot> Parse(std::istream& in)
+    {
+        std::shared_ptr<ConfigSnapshot> config(new ConfigSnapshot);
+        std::string line;
+        for(int number = 1; std::getline(in, line); number++){
+            size_t comment = line.find('#');
+            if( comment != std::string::npos )
+                line.erase(comment);
+            if( Trim(line).empty() )
+                continue;
+
+            size_t equal = line.find('=');
+            if( equal == std::string::npos )
+                Fail(number, "expected key = value");
+
+            std::string key = Trim(line.substr(0, equal));
+            std::string value = Trim(line.substr(equal + 1));
+            if( !config->Set(key, value) )
+                Fail(number, "bad value for " + key);
+        }
+
+        for(auto& logger : config->loggers){
+            for(auto& name : logger.second.appenders){
+                if( config->appenders.count(name) == 0 )
+                    throw std::invalid_argument("logger " + logger.first + ": unknown appender " + name + ".");
+            }
+        }
+        for(auto& appender : config->appenders){
+            if( appender.second.type.empty() )
+                throw std::invalid_argument("appender " + appender.first + ": missing type.");
+
+            // a bad pattern fails the parse, not the apply.
+            if( appender.second.formatter == "pattern" ){
+                try{
+                    PatternFormatter check(appender.second.pattern);
+                }catch(const std::invalid_argument& ex){
+                    throw std::invalid_argument("appender " + appender.first + ": " + ex.what());
+                }
+            }
+        }
+
+        return config;
+    }
+
+    static std::shared_ptr<const ConfigSnapshot> Load(const std::string& file_path)
+    {
+        std::ifstream in(file_path);
+        if( !in )
+            throw std::invalid_argument("can't open " + file_path + ".");
+
+        return Parse(in);
+    }
+
+    static bool ParseLevel(const std::string& name, Level& level)
+    {
+        static const char* names[] = {"ALL", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", "OFF"};
+        for(int index = 0; index <= static_cast<int>(Level::OFF); index++){
+            if( name == names[index] ){
+                level = static_cast<Level>(index);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    bool Set(const std::string& key, const std::string& value)
+    {
+        if( key == "lowest_level" )
+            return ParseLevel(value, lowest_level);
+        if( key == "backup_count" )
+            return ParseNumber(value, 0, 1000, backup_count);
+        if( key == "max_file_size" )
+            return ParseNumber(value, 1, 10 * 1024, max_file_size);
+        if( key == "backup_compress" ){
+            backup_compress = value == "true";
+#ifndef LOG4CPP_WITH_ZLIB
+            // Configure would refuse it half way through the apply.
+            if( backup_compress )
+                return false;
+#endif
+            return value == "true" || value == "false";
+        }
+
+        if( key.compare(0, 7, "logger.") == 0 && key.size() > 7 )
+            return SetLogger(key.substr(7), value);
+        if( key.compare(0, 9, "appender.") == 0 && key.size() > 9 )
+            return SetAppender(key.substr(9), value);
+
+        return false;
+    }
+
+    bool SetLogger(const std::string& name, const std::string& value)
+    {
+        LoggerSpec& logger = loggers[name];
+        std::stringstream items(value);
+        std::string item;
+        for(bool first = true; std::getline(items, item, ','); first = false){
+            item = Trim(item);
+            if( first ){
+                logger.has_level = !item.empty();
+                if( logger.has_level && !ParseLevel(item, logger.level) )
+                    return false;
+            }else if( item.empty() ){
+                return false;
+            }else{
+                logger.appenders.push_back(item);
+            }
+        }
+        return true;
+    }
+
+    bool SetAppender(const std::string& key, const std::string& value)
+    {
+        size_t dot = key.find('.');
+        AppenderSpec& appender = appenders[key.substr(0, dot)];
+        std::string word = value.substr(0, value.find(' '));
+        std::string rest = word.size() < value.size() ? Trim(value.substr(word.size())) : "";
+
+        if( dot == std::string::npos ){
+            appender.type = word;
+            appender.path = rest;
+            if( word == "console" )
+                return rest.empty();
+            return (word == "file" || word == "mmap" || word == "async" || word == "binary") && !rest.empty();
+        }
+
+        if( key.substr(dot + 1) != "formatter" )
+            return false;
+
+        appender.formatter = word;
+        appender.pattern = rest;
+        if( word == "pattern" )
+            return !rest.empty();
+        return (word == "console" || word == "file" || word == "json") && rest.empty();
+    }
+
+    static bool ParseNumber(const std::string& value, unsigned int low, unsigned int high, unsigned int& number)
+    {
+        char* end = nullptr;
+        unsigned long parsed = strtoul(value.c_str(), &end, 10);
+        if( value.empty() || *end != '\0' || parsed < low || parsed > high )
+            return false;
+
+        number = parsed;
+        return true;
+    }
+
+    static std::string Trim(const std::string& text)
+    {
+        size_t begin = text.find_first_not_of(" \t\r");
+        if( begin == std::string::npos )
+            return "";
+        size_t end = text.find_last_not_of(" \t\r");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    static void Fail(int number, const std::string& reason)
+    {
+        throw std::invalid_argument("line " + std::to_string(number) + ": " + reason + ".");
+    }
+};
+
+/**
+ * applies a configuration file and, once started, reapplies it whenever
+ * the file is written or replaced (watched with inotify). a file being
+ * created is only read once closed, so a half written file isn't applied.
+ *
+ * a reload swaps what changed in place: levels, the loggers' appender
+ * lists and the appenders' formatters are all copy-on-write, so logging
+ * threads never wait. everything that can fail (parsing and checking
+ * every value, formatters, new appenders) is done before anything is
+ * changed, so a failed reload leaves the current config untouched. a
+ * reload isn't atomic for the logging threads though: while it is
+ * applied they may see some loggers changed and others not yet.
+ * appenders whose type and file stay the same are kept with their
+ * queues; replaced ones are stopped only after no logger can reach
+ * them, which writes out everything they still hold.
+ *
+ * loggers named in the file get their level and appenders from it, a
+ * logger dropped from the file inherits its level again and loses its
+ * appenders. a file that fails to parse is reported and ignored.
+ */
+class ConfigWatcher
+{
+public:
+    ConfigWatcher(const std::string& file_path) : _file_path(file_path)
+    {
+    }
+    ~ConfigWatcher()
+    {
+        Stop();
+    }
+
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator= (const ConfigWatcher&) = delete;
+
+    // parse and apply now, throw std::invalid_argument if the file is bad.
+    void Load()
+    {
+        Apply(ConfigSnapshot::Load(_file_path));
+    }
+
+    // Load() then follow the file.
+    void Start()
+    {
+        if( _watch_thread.joinable() )
+            return;
+
+        Load();
+
+        std::string dir = ".";
+        size_t slash = _file_path.rfind('/');
+        if( slash != std::string::npos )
+            dir = slash == 0 ? "/" : _file_path.substr(0, slash);
+        _file_name = _file_path.substr(slash == std::string::npos ? 0 : slash + 1);
+
+        _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if( _inotify_fd < 0 || inotify_add_watch(_inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+            pipe2(_wake_fds, O_CLOEXEC) != 0 ){
+            std::cerr << "fail to watch " << _file_path << ": " << strerror(errno) << std::endl;
+            CloseFds();
+            return;
+        }
+
+        _watch_thread = std::thread(&ConfigWatcher::Watch, this);
+    }
+
+    void Stop()
+    {
+        if( !_watch_thread.joinable() )
+            return;
+
+        char wake = 0;
+        if( write(_wake_fds[1], &wake, 1) != 1 )
+            std::cerr << "fail to wake config watcher" << std::endl;
+        _watch_thread.join();
+        CloseFds();
+    }
+
+    // the configuration in effect, nullptr before the first Load().
+    std::shared_ptr<const ConfigSnapshot> Current() const
+    {
+        return std::atomic_load(&_current);
+    }
+
+    // counts applied configurations.
+    uint64_t Generation() const
+    {
+        return _generation.load(std::memory_order_acquire);
+    }
+
+    std::shared_ptr<Appender> GetAppender(const std::string& name) const
+    {
+        std::lock_guard<std::mutex> lock(_apply_mtx);
+        auto iter = _appenders.find(name);
+        return iter == _appenders.end() ? std::shared_ptr<Appender>() : iter->second;
+    }
+
+private:
+    void Apply(const std::shared_ptr<const ConfigSnapshot>& config)
+    {
+        std::lock_guard<std::mutex> lock(_apply_mtx);
+        std::shared_ptr<const ConfigSnapshot> old = Current();
+
+        // build first, nothing shared is changed until all of it worked.
+        // appenders still writing the same target are kept.
+        std::map<std::string, std::shared_ptr<Appender>> appenders;
+        std::map<std::string, std::shared_ptr<Formatter>> formatters;
+        std::vector<std::shared_ptr<Appender>> created;
+        for(auto& spec : config->appenders){
+            const ConfigSnapshot::AppenderSpec* old_spec = nullptr;
+            if( old && old->appenders.count(spec.first) != 0 )
+                old_spec = &old->appenders.at(spec.first);
+
+            if( old_spec != nullptr && old_spec->SameTarget(spec.second) ){
+                appenders[spec.first] = _appenders[spec.first];
+                if( !old_spec->SameFormatter(spec.second) )
+                    formatters[spec.first] = MakeFormatter(spec.second);
+                continue;
+            }
+
+            appenders[spec.first] = MakeAppender(spec.second);
+            formatters[spec.first] = MakeFormatter(spec.second);
+            created.push_back(appenders[spec.first]);
+        }
+
+        // Parse checked the ranges, none of these throws.
+        Configure& cfg = Configure::Instance();
+        cfg.SetBackupCount(config->backup_count);
+        cfg.SetLogFileMaxSize(config->max_file_size);
+        cfg.SetBackupCompress(config->backup_compress);
+        cfg.SetLowestLevel(config->lowest_level);
+
+        for(auto& formatter : formatters)
+            appenders[formatter.first]->SetFormatter(formatter.second);
+        for(auto& appender : created)
+            appender->Start();
+
+        for(auto& spec : config->loggers){
+            std::shared_ptr<Logger> logger = Logger::GetLogger(spec.first);
+            if( spec.second.has_level )
+                logger->SetLevel(spec.second.level);
+            else
+                logger->ResetLevel();
+
+            Logger::AppenderList list;
+            for(auto& name : spec.second.appenders)
+                list.push_back(appenders[name]);
+            logger->SetAppenders(list);
+        }
+        if( old ){
+            for(auto& spec : old->loggers){
+                if( config->loggers.count(spec.first) != 0 )
+                    continue;
+
+                std::shared_ptr<Logger> logger = Logger::GetLogger(spec.first);
+                logger->ResetLevel();
+                logger->SetAppenders(Logger::AppenderList());
+            }
+        }
+
+        // unreachable now, stopping writes out what they still queue.
+        for(auto& iter : _appenders){
+            auto kept = appenders.find(iter.first);
+            if( (kept == appenders.end() || kept->second != iter.second) && iter.second != ConsoleAppender::Get() )
+                iter.second->Stop();
+        }
+
+        _appenders.swap(appenders);
+        std::atomic_store(&_current, config);
+        _generation.fetch_add(1, std::memory_order_release);
+    }
+
+    static std::shared_ptr<Appender> MakeAppender(const ConfigSnapshot::AppenderSpec& spec)
+    {
+        const char* path = spec.path.c_str();
+        if( spec.type == "console" )
+            return ConsoleAppender::Get();
+        if( spec.type == "mmap" )
+            return std::make_shared<MmapFileAppender>(path);
+        if( spec.type == "async" )
+            return std::make_shared<AsyncFileAppender>(path);
+        if( spec.type == "binary" )
+            return std::make_shared<BinaryFileAppender>(path);
+
+        return std::make_shared<FileAppender>(path);
+    }
+
+    static std::shared_ptr<Formatter> MakeFormatter(const ConfigSnapshot::AppenderSpec& spec)
+    {
+        std::string type = spec.formatter;
+        if( type.empty() )
+            type = spec.type == "console" ? "console" : "file";
+
+        if( type == "console" )
+            return std::make_shared<ConsoleFormatter>();
+        if( type == "json" )
+            return std::make_shared<JsonFormatter>();
+        if( type == "pattern" )
+            return std::make_shared<PatternFormatter>(spec.pattern);
+
+        return std::make_shared<FileFormatter>();
+    }
+
+    void Watch()
+    {
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        struct pollfd fds[2] = {{_inotify_fd, POLLIN, 0}, {_wake_fds[0], POLLIN, 0}};
+
+        while( true ){
+            if( poll(fds, 2, -1) < 0 && errno != EINTR )
+                break;
+            if( fds[1].revents != 0 )
+                break;
+            if( fds[0].revents == 0 )
+                continue;
+
+            bool changed = false;
+            ssize_t len;
+            while( (len = read(_inotify_fd, buffer, sizeof(buffer))) > 0 ){
+                for(char* pos = buffer; pos < buffer + len; ){
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(pos);
+                    if( event->len > 0 && _file_name == event->name )
+                        changed = true;
+                    pos += sizeof(struct inotify_event) + event->len;
+                }
+            }
+
+            if( !changed )
+                continue;
+
+            try{
+                Load();
+            }catch(const std::exception& ex){
+                std::cerr << "keep the current config, " << _file_path << ": " << ex.what() << std::endl;
+            }
+        }
+    }
+
+    void CloseFds()
+    {
+        for(int* fd : {&_inotify_fd, &_wake_fds[0], &_wake_fds[1]}){
+            if( *fd >= 0 )
+                close(*fd);
+            *fd = -1;
+        }
+    }
+
+private:
+    std::string _file_path;
+    std::string _file_name;
+
+    std::shared_ptr<const ConfigSnapshot> _current;
+    std::atomic<uint64_t> _generation{0};
+
+    // applied side, guarded by _apply_mtx.
+    mutable std::mutex _apply_mtx;
+    std::map<std::string, std::shared_ptr<Appender>> _appenders;
+
+    int _inotify_fd{-1};
+    int _wake_fds[2]{-1, -1};
+    std::thread _watch_thread;
+};
+}
+
+#endif
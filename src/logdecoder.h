@@ -0,0 +1,280 @@
+/**
+ * Light weight log lib for c++.
+ *
+ * logdecoder.h
+ *
+ * reads back the files written by BinaryFileAppender.
+ */
+
+#ifndef _LOG4CPP_DECODER_H_
+#define _LOG4CPP_DECODER_H_
+
+#include <string>
+#include <deque>
+#include <map>
+#include <fstream>
+#include <iterator>
+
+#include "log4cpp.h"
+
+namespace Log4CPP
+{
+/**
+ * sequential reader of a BinaryFormat file.
+ *
+ * Next() decodes one event; its module, format and thread name point into
+ * the reader's string table, so the event is only valid until the next
+ * call. reading stops at the first torn or unknown record, Truncated()
+ * tells whether data was left behind. a record whose length is sound but
+ * whose body doesn't decode is skipped and counted by Skipped().
+ *
+ * the file is read a chunk at a time, only a record larger than a chunk
+ * grows the buffer.
+ */
+class BinaryLogReader
+{
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+public:
+    bool Open(const std::string& file_path)
+    {
+        _in.close();
+        _in.clear();
+        _in.open(file_path, std::ios::binary | std::ios::ate);
+        if( !_in )
+            return false;
+
+        _size = static_cast<uint64_t>(_in.tellg());
+        _in.seekg(0);
+        _data.clear();
+        _base = 0;
+        _pos = 0;
+        _truncated = false;
+        _skipped = 0;
+        _version = 0;
+
+        size_t available = Fill(BinaryFormat::MAGIC_SIZE + 1);
+        if( !BinaryFormat::IsHeader(_data.data() + _pos, available) )
+            return available == 0;
+
+        return true;
+    }
+
+    bool Next(LogEvent& e)
+    {
+        while( true ){
+            // a segment header or a length varint fits in 16 bytes.
+            size_t available = Fill(16);
+            if( available == 0 )
+                return false;
+
+            if( BinaryFormat::IsHeader(_data.data() + _pos, available) ){
+                NewSegment();
+                continue;
+            }
+
+            const char* pos = _data.data() + _pos;
+            uint64_t length;
+            if( _version == 0 || !BinaryFormat::GetVarint(pos, pos + available, length) )
+                return Torn();
+
+            size_t head = pos - (_data.data() + _pos);
+            if( length > _size - (_base + _pos + head) || Fill(head + length) < head + length )
+                return Torn();
+
+            const char* body = _data.data() + _pos + head;
+            const char* end = body + length;
+            _pos += head + length;
+            if( length == 0 )
+                continue;
+
+            uint8_t type = static_cast<uint8_t>(*body);
+            if( type == BinaryFormat::STRING ){
+                if( !ReadString(body + 1, end) )
+                    _skipped++;
+            }else if( type == BinaryFormat::EVENT ){
+                if( ReadEvent(body + 1, end, e) )
+                    return true;
+                _skipped++;
+            }else{
+                return Torn();
+            }
+        }
+    }
+
+    bool Truncated() const { return _truncated; }
+    // corrupt records passed over.
+    uint64_t Skipped() const { return _skipped; }
+    // version of the current segment, 0 before the first one.
+    int Version() const { return _version; }
+
+private:
+    /**
+     * make at least need bytes past _pos available unless the file ends
+     * first, return how many are. bytes before _pos are dropped.
+     */
+    size_t Fill(size_t need)
+    {
+        if( _data.size() - _pos >= need )
+            return _data.size() - _pos;
+
+        _data.erase(0, _pos);
+        _base += _pos;
+        _pos = 0;
+
+        uint64_t left = _size - (_base + _data.size());
+        size_t want = need - _data.size() > CHUNK_SIZE ? need - _data.size() : CHUNK_SIZE;
+        if( want > left )
+            want = left;
+        size_t old_size = _data.size();
+        _data.resize(old_size + want);
+        _in.read(&_data[old_size], want);
+        _data.resize(old_size + static_cast<size_t>(_in.gcount()));
+
+        return _data.size();
+    }
+
+    void NewSegment()
+    {
+        _version = static_cast<uint8_t>(_data[_pos + BinaryFormat::MAGIC_SIZE]);
+        _pos += BinaryFormat::MAGIC_SIZE + 1;
+        _strings.clear();
+        _storage.clear();
+        _last_timestamp = 0;
+
+        // a newer layout can't be read, stop rather than misread it.
+        if( _version > BinaryFormat::VERSION ){
+            _version = 0;
+            Torn();
+        }
+    }
+
+    // stop reading, whatever is left can't be trusted.
+    bool Torn()
+    {
+        _truncated = true;
+        _data.clear();
+        _pos = 0;
+        _base = _size;
+        return false;
+    }
+
+    bool ReadString(const char* pos, const char* end)
+    {
+        uint64_t id;
+        if( !BinaryFormat::GetVarint(pos, end, id) )
+            return false;
+
+        _storage.emplace_back(pos, end);
+        _strings[id] = _storage.back().c_str();
+        return true;
+    }
+
+    bool ReadEvent(const char* pos, const char* end, LogEvent& e)
+    {
+        if( pos >= end )
+            return false;
+        uint8_t flags = static_cast<uint8_t>(*pos++);
+
+        uint64_t delta, tid, module;
+        if( !BinaryFormat::GetVarint(pos, end, delta) || !BinaryFormat::GetVarint(pos, end, tid) || pos >= end )
+            return false;
+        int level = static_cast<uint8_t>(*pos++);
+        if( level > static_cast<int>(Level::OFF) || !BinaryFormat::GetVarint(pos, end, module) )
+            return false;
+
+        const char* module_name = String(module);
+        if( module_name == nullptr )
+            return false;
+
+        _last_timestamp += BinaryFormat::UnZigZag(delta);
+        timeval timestamp;
+        timestamp.tv_sec = _last_timestamp / 1000000;
+        timestamp.tv_usec = _last_timestamp % 1000000;
+
+        const char* data;
+        uint64_t size;
+        if( flags & BinaryFormat::DEFERRED ){
+            uint64_t format;
+            if( !BinaryFormat::GetVarint(pos, end, format) || String(format) == nullptr || !GetBytes(pos, end, data, size) )
+                return false;
+
+            LogArgs args;
+            args.Assign(data, size);
+            if( !args.Valid() )
+                return false;
+            e = LogEvent(tid, module_name, static_cast<Level>(level), "");
+            e.SetDeferred(String(format), std::move(args));
+        }else{
+            if( !GetBytes(pos, end, data, size) )
+                return false;
+
+            e = LogEvent(tid, module_name, static_cast<Level>(level), std::string(data, size).c_str());
+        }
+        e.SetTimestamp(timestamp);
+
+        std::shared_ptr<ThreadTag> tag;
+        if( flags & (BinaryFormat::NAME | BinaryFormat::CONTEXT) )
+            tag.reset(new ThreadTag);
+        if( flags & BinaryFormat::NAME ){
+            uint64_t name;
+            if( !BinaryFormat::GetVarint(pos, end, name) || String(name) == nullptr )
+                return false;
+            tag->name = String(name);
+        }
+        if( flags & BinaryFormat::CONTEXT ){
+            if( !GetBytes(pos, end, data, size) )
+                return false;
+            tag->context.assign(data, size);
+        }
+        e.SetThreadTag(tag);
+
+        if( flags & BinaryFormat::FIELDS ){
+            if( !GetBytes(pos, end, data, size) )
+                return false;
+
+            LogArgs fields;
+            fields.Assign(data, size);
+            if( !fields.Valid() )
+                return false;
+            e.SetFields(std::move(fields));
+        }
+
+        return true;
+    }
+
+    const char* String(uint64_t id) const
+    {
+        auto iter = _strings.find(id);
+        return iter == _strings.end() ? nullptr : iter->second;
+    }
+
+    static bool GetBytes(const char*& pos, const char* end, const char*& data, uint64_t& size)
+    {
+        if( !BinaryFormat::GetVarint(pos, end, size) || size > static_cast<uint64_t>(end - pos) )
+            return false;
+
+        data = pos;
+        pos += size;
+        return true;
+    }
+
+private:
+    std::ifstream _in;
+    uint64_t _size{0};
+    // _data holds the file's bytes from _base on, _pos is the next record.
+    std::string _data;
+    uint64_t _base{0};
+    size_t _pos{0};
+    bool _truncated{false};
+    uint64_t _skipped{0};
+    int _version{0};
+
+    // string table of the current segment.
+    std::map<uint64_t, const char*> _strings;
+    std::deque<std::string> _storage;
+    int64_t _last_timestamp{0};
+};
+}
+
+#endif
@@ -12,6 +12,7 @@
 
 #include <cstdarg>
 #include <cstring>
+#include <ctime>
 #include <sstream>
 
 #include <string>
@@ -20,22 +21,346 @@
 
 #include "log4cpp.h"
 
+/**
+ * compile time lowest level, statements below it compile to nothing.
+ *
+ * e.g. -DLOG4CPP_ACTIVE_LEVEL=LOG4CPP_LEVEL_INFO drops every LOG_DEBUG.
+ */
+#define LOG4CPP_LEVEL_ALL   0
+#define LOG4CPP_LEVEL_DEBUG 1
+#define LOG4CPP_LEVEL_INFO  2
+#define LOG4CPP_LEVEL_WARN  3
+#define LOG4CPP_LEVEL_ERROR 4
+#define LOG4CPP_LEVEL_FATAL 5
+#define LOG4CPP_LEVEL_OFF   6
+
+#ifndef LOG4CPP_ACTIVE_LEVEL
+#define LOG4CPP_ACTIVE_LEVEL LOG4CPP_LEVEL_ALL
+#endif
+
+// Logger method name to level.
+#define LOG4CPP_Debug_LEVEL Log4CPP::Level::DEBUG
+#define LOG4CPP_Info_LEVEL  Log4CPP::Level::INFO
+#define LOG4CPP_Warn_LEVEL  Log4CPP::Level::WARN
+#define LOG4CPP_Error_LEVEL Log4CPP::Level::ERROR
+#define LOG4CPP_Fatal_LEVEL Log4CPP::Level::FATAL
+
 namespace
 {
-const static int MAX_LOG_BUF_LEN = 4096;
+// deprecated, LOG_* lines are no longer cut at this length.
+__attribute__((deprecated)) const static int MAX_LOG_BUF_LEN = 4096;
+}
+
+namespace Log4CPP
+{
+/**
+ * printf formatted line of the LOG_* macros, prefixed by the call site.
+ *
+ * lines up to MAX_STACK_LEN are formatted on the stack, longer ones on the
+ * heap, so nothing is truncated. the format attribute lets the compiler
+ * check the arguments against the format.
+ */
+class PrintfLine
+{
+public:
+    static const int MAX_STACK_LEN = 4096;
+
+    PrintfLine(const char* file, int line, const char* function, const char* format, ...)
+        __attribute__((format(printf, 5, 6)))
+    {
+        int len = snprintf(_stack, sizeof(_stack), "[%s:%d][%s] ", file, line, function);
+        if( len < 0 || len >= MAX_STACK_LEN ){
+            _stack[0] = '\0';
+            len = 0;
+        }
+
+        va_list args;
+        va_start(args, format);
+        va_list retry;
+        va_copy(retry, args);
+
+        int text_len = vsnprintf(_stack + len, sizeof(_stack) - len, format, args);
+        if( text_len >= 0 && len + text_len >= MAX_STACK_LEN ){
+            _heap.assign(_stack, len);
+            _heap.resize(len + text_len + 1);
+            vsnprintf(&_heap[len], text_len + 1, format, retry);
+            _heap.resize(len + text_len);
+        }
+
+        va_end(retry);
+        va_end(args);
+    }
+
+    PrintfLine(const PrintfLine&) = delete;
+    PrintfLine& operator= (const PrintfLine&) = delete;
+
+    const char* Text() const { return _heap.empty() ? _stack : _heap.c_str(); }
+
+    // " [N suppressed]" after the text, for the rate limited macros.
+    void AppendSuppressed(uint64_t count)
+    {
+        if( count == 0 )
+            return;
+
+        if( _heap.empty() )
+            _heap.assign(_stack);
+        _heap.append(" [").append(std::to_string(count)).append(" suppressed]");
+    }
 
-#define LOG(logger, level, format...) {\
-    char buffer[MAX_LOG_BUF_LEN] = {0}; \
-    sprintf(buffer, "[%s:%d][%s] ", __FILE__, __LINE__, __FUNCTION__); \
-    sprintf(buffer + strlen(buffer), format); \
-    logger->level(buffer); \
+private:
+    char _stack[MAX_STACK_LEN];
+    std::string _heap;
+};
+
+/**
+ * call site state of the rate limited macros, a static of the statement.
+ *
+ * each check tells whether the call may log and, when it does, how many
+ * calls were suppressed since the last line. a suppressed call costs one
+ * relaxed increment, plus a coarse clock read for the timed checks.
+ * constant initialized, so the statics need no guard.
+ */
+class LogRate
+{
+public:
+    constexpr LogRate() {}
+
+    LogRate(const LogRate&) = delete;
+    LogRate& operator= (const LogRate&) = delete;
+
+    // the 1st, n+1th, 2n+1th ... calls.
+    bool EveryN(uint64_t n, uint64_t& suppressed)
+    {
+        uint64_t count = _count.fetch_add(1, std::memory_order_relaxed);
+        if( n > 1 && count % n != 0 )
+            return false;
+
+        suppressed = count == 0 || n <= 1 ? 0 : n - 1;
+        return true;
+    }
+
+    // the first n calls only.
+    bool FirstN(uint64_t n, uint64_t& suppressed)
+    {
+        suppressed = 0;
+        return _count.fetch_add(1, std::memory_order_relaxed) < n;
+    }
+
+    // at most one call per ms milliseconds.
+    bool EveryMs(uint64_t ms, uint64_t& suppressed)
+    {
+        uint64_t now = NowNs();
+        uint64_t next = _next.load(std::memory_order_relaxed);
+        if( now < next || !_next.compare_exchange_strong(next, now + ms * 1000000, std::memory_order_relaxed) ){
+            _suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * token bucket of burst tokens refilled at per_second, as a virtual
+     * arrival time: a call fits when it would not push that time more
+     * than burst intervals ahead of now.
+     */
+    bool TokenBucket(double per_second, uint64_t burst, uint64_t& suppressed)
+    {
+        if( per_second <= 0 ){
+            _suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        uint64_t interval = static_cast<uint64_t>(1e9 / per_second);
+        uint64_t now = NowNs();
+        uint64_t arrival = _next.load(std::memory_order_relaxed);
+        while( true ){
+            uint64_t next = std::max(arrival, now) + interval;
+            if( next - now > interval * std::max<uint64_t>(burst, 1) ){
+                _suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if( _next.compare_exchange_weak(arrival, next, std::memory_order_relaxed) )
+                break;
+        }
+
+        suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    // a few ns through the vdso, resolution of a scheduler tick.
+    static uint64_t NowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+private:
+    std::atomic<uint64_t> _count{0};
+    std::atomic<uint64_t> _next{0};
+    std::atomic<uint64_t> _suppressed{0};
+};
 }
 
+// check the level first, disabled statements never format anything.
+#define LOG(logger, level, format...) do{\
+    if( (logger)->IsEnabled(LOG4CPP_##level##_LEVEL) ){ \
+        Log4CPP::PrintfLine log4cpp_line(__FILE__, __LINE__, __FUNCTION__, format); \
+        (logger)->level(log4cpp_line.Text()); \
+    } \
+}while(0)
+
+#define LOG_DISABLED(logger, format...) do{}while(0)
+
+/**
+ * LOG with a limit per call site, the next line after suppressed calls
+ * ends with " [N suppressed]":
+ *
+ *   LOG_EVERY_N(logger, Error, 100, "...")          1st, 101st, 201st ... call
+ *   LOG_FIRST_N(logger, Error, 10, "...")           first 10 calls
+ *   LOG_EVERY_MS(logger, Error, 1000, "...")        one per second
+ *   LOG_RATE_LIMITED(logger, Error, 5, 20, "...")   5 per second, bursts of 20
+ *
+ * disabled levels count nothing, levels below LOG4CPP_ACTIVE_LEVEL
+ * compile to nothing. in a template every instantiation has its own limit.
+ */
+#define LOG4CPP_LIMITED(logger, level, check, format...) \
+    LOG4CPP_LIMITED_##level(logger, level, check, format)
+
+#define LOG4CPP_LIMITED_ENABLED(logger, level, check, format...) do{\
+    static Log4CPP::LogRate log4cpp_rate; \
+    uint64_t log4cpp_suppressed = 0; \
+    if( (logger)->IsEnabled(LOG4CPP_##level##_LEVEL) && log4cpp_rate.check ){ \
+        Log4CPP::PrintfLine log4cpp_line(__FILE__, __LINE__, __FUNCTION__, format); \
+        log4cpp_line.AppendSuppressed(log4cpp_suppressed); \
+        (logger)->level(log4cpp_line.Text()); \
+    } \
+}while(0)
+
+#define LOG_EVERY_N(logger, level, n, format...) \
+    LOG4CPP_LIMITED(logger, level, EveryN(n, log4cpp_suppressed), format)
+#define LOG_FIRST_N(logger, level, n, format...) \
+    LOG4CPP_LIMITED(logger, level, FirstN(n, log4cpp_suppressed), format)
+#define LOG_EVERY_MS(logger, level, ms, format...) \
+    LOG4CPP_LIMITED(logger, level, EveryMs(ms, log4cpp_suppressed), format)
+#define LOG_RATE_LIMITED(logger, level, per_second, burst, format...) \
+    LOG4CPP_LIMITED(logger, level, TokenBucket(per_second, burst, log4cpp_suppressed), format)
+
+/**
+ * "{}" format, checked at compile time: the placeholders must match the
+ * arguments and braces must be balanced ("{{" and "}}" are literal).
+ * arguments keep their own types, no vararg promotion, and the text has
+ * no length limit. format must be a string literal, it is rendered on
+ * the writer thread.
+ */
+#define LOG4CPP_CHECK_FORMAT(format, args...) \
+    static_assert(Log4CPP::FormatCheck::Placeholders(format) >= 0, \
+        "lone '{' or '}' in log format, use {{ or }}"); \
+    static_assert(Log4CPP::FormatCheck::Placeholders(format) == decltype(Log4CPP::FormatCheck::Count(args))::value, \
+        "log format placeholders don't match the arguments")
+
+#define LOGF(logger, level, format, args...) do{\
+    LOG4CPP_CHECK_FORMAT(format, ##args); \
+    if( (logger)->IsEnabled(LOG4CPP_##level##_LEVEL) ) \
+        (logger)->level("[{}:{}][{}] " format, __FILE__, __LINE__, __FUNCTION__, ##args); \
+}while(0)
+
+// compiled out statements are still checked.
+#define LOGF_DISABLED(logger, format, args...) do{\
+    LOG4CPP_CHECK_FORMAT(format, ##args); \
+}while(0)
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_DEBUG
 #define LOG_DEBUG(logger, format...) LOG(logger, Debug, format)
+#else
+#define LOG_DEBUG(logger, format...) LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_INFO
 #define LOG_INFO(logger, format...)  LOG(logger, Info, format)
-#define LOG_WARN(logger, format...)  LOG(logger, Warn, format) 
+#else
+#define LOG_INFO(logger, format...)  LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_WARN
+#define LOG_WARN(logger, format...)  LOG(logger, Warn, format)
+#else
+#define LOG_WARN(logger, format...)  LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_ERROR
 #define LOG_ERROR(logger, format...) LOG(logger, Error, format)
+#else
+#define LOG_ERROR(logger, format...) LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_FATAL
 #define LOG_FATAL(logger, format...) LOG(logger, Fatal, format)
+#else
+#define LOG_FATAL(logger, format...) LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_DEBUG
+#define LOG4CPP_LIMITED_Debug(logger, level, check, format...) LOG4CPP_LIMITED_ENABLED(logger, level, check, format)
+#else
+#define LOG4CPP_LIMITED_Debug(logger, level, check, format...) LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_INFO
+#define LOG4CPP_LIMITED_Info(logger, level, check, format...)  LOG4CPP_LIMITED_ENABLED(logger, level, check, format)
+#else
+#define LOG4CPP_LIMITED_Info(logger, level, check, format...)  LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_WARN
+#define LOG4CPP_LIMITED_Warn(logger, level, check, format...)  LOG4CPP_LIMITED_ENABLED(logger, level, check, format)
+#else
+#define LOG4CPP_LIMITED_Warn(logger, level, check, format...)  LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_ERROR
+#define LOG4CPP_LIMITED_Error(logger, level, check, format...) LOG4CPP_LIMITED_ENABLED(logger, level, check, format)
+#else
+#define LOG4CPP_LIMITED_Error(logger, level, check, format...) LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_FATAL
+#define LOG4CPP_LIMITED_Fatal(logger, level, check, format...) LOG4CPP_LIMITED_ENABLED(logger, level, check, format)
+#else
+#define LOG4CPP_LIMITED_Fatal(logger, level, check, format...) LOG_DISABLED(logger, format)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_DEBUG
+#define LOGF_DEBUG(logger, format, args...) LOGF(logger, Debug, format, ##args)
+#else
+#define LOGF_DEBUG(logger, format, args...) LOGF_DISABLED(logger, format, ##args)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_INFO
+#define LOGF_INFO(logger, format, args...)  LOGF(logger, Info, format, ##args)
+#else
+#define LOGF_INFO(logger, format, args...)  LOGF_DISABLED(logger, format, ##args)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_WARN
+#define LOGF_WARN(logger, format, args...)  LOGF(logger, Warn, format, ##args)
+#else
+#define LOGF_WARN(logger, format, args...)  LOGF_DISABLED(logger, format, ##args)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_ERROR
+#define LOGF_ERROR(logger, format, args...) LOGF(logger, Error, format, ##args)
+#else
+#define LOGF_ERROR(logger, format, args...) LOGF_DISABLED(logger, format, ##args)
+#endif
+
+#if LOG4CPP_ACTIVE_LEVEL <= LOG4CPP_LEVEL_FATAL
+#define LOGF_FATAL(logger, format, args...) LOGF(logger, Fatal, format, ##args)
+#else
+#define LOGF_FATAL(logger, format, args...) LOGF_DISABLED(logger, format, ##args)
+#endif
 
-}
 #endif
@@ -0,0 +1,329 @@
+/**
+ * log4cpp micro benchmarks.
+ *
+ * caller side latency percentiles and end to end throughput for 1..64
+ * producer threads, per api (const char*, LogStream, LOG_* macros,
+ * deferred "{}" format, checked LOGF_* macros) and per appender (console redirected to
+ * /dev/null, file), plus the single thread cost of each formatter and
+ * of a suppressed rate limited statement.
+ * results go to stdout as json.
+ *
+ * usage: bench [--events N] [--threads 1,2,4] [--runs N]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "log4cpp.h"
+#include "loghelper.h"
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+const char* BENCH_FILE = "bench.log";
+
+enum class Api : int
+{
+    CSTR = 0,
+    STREAM,
+    MACRO,
+    DEFERRED,
+    CHECKED
+};
+
+const char* ApiName(Api api)
+{
+    switch(api)
+    {
+    case Api::CSTR:     return "cstr";
+    case Api::STREAM:   return "stream";
+    case Api::MACRO:    return "macro";
+    case Api::DEFERRED: return "deferred";
+    case Api::CHECKED:  return "checked";
+    }
+
+    return "";
+}
+
+struct Options
+{
+    int events = 100000;    // per case, split over the producers.
+    int runs = 1;           // best throughput of N runs.
+    std::vector<int> threads{1, 2, 4, 8, 16, 32, 64};
+};
+
+struct Result
+{
+    Api api;
+    std::string appender;
+    int threads;
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+    double throughput;      // events per second, until written.
+};
+
+void LogOnce(const std::shared_ptr<Log4CPP::Logger>& logger, Api api, int index)
+{
+    switch(api)
+    {
+    case Api::CSTR:
+        logger->Info("benchmark log line with a fixed text payload");
+        break;
+    case Api::STREAM:
+        logger->Info() << "benchmark log line " << index << " value " << 3.5 << Log4CPP::Endl;
+        break;
+    case Api::MACRO:
+        LOG_INFO(logger, "benchmark log line %d value %f", index, 3.5);
+        break;
+    case Api::DEFERRED:
+        logger->Info("benchmark log line {} value {}", index, 3.5);
+        break;
+    case Api::CHECKED:
+        LOGF_INFO(logger, "benchmark log line {} value {}", index, 3.5);
+        break;
+    }
+}
+
+double Percentile(std::vector<uint32_t>& samples, double ratio)
+{
+    if( samples.empty() )
+        return 0;
+
+    size_t index = std::min(samples.size() - 1, (size_t)(ratio * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+std::shared_ptr<Log4CPP::Appender> MakeAppender(const std::string& name)
+{
+    if( name == "console" )
+        return Log4CPP::ConsoleAppender::Get();
+
+    remove(BENCH_FILE);
+    return std::shared_ptr<Log4CPP::Appender>(new Log4CPP::FileAppender(BENCH_FILE));
+}
+
+Result RunCase(Api api, const std::string& appender_name, int thread_count, int events)
+{
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::shared_ptr<Log4CPP::Appender> appender = MakeAppender(appender_name);
+    appender->SetFormatter(formatter);
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("bench");
+    logger->AddAppender(appender);
+
+    int per_thread = std::max(1, events / thread_count);
+    std::vector<std::vector<uint32_t>> latencies(thread_count);
+    std::vector<std::thread> producers;
+
+    Clock::time_point begin = Clock::now();
+    for(int id = 0; id < thread_count; id++){
+        producers.push_back(std::thread([&, id]{
+            std::vector<uint32_t>& samples = latencies[id];
+            samples.reserve(per_thread);
+
+            for(int index = 0; index < per_thread; index++){
+                Clock::time_point call = Clock::now();
+                LogOnce(logger, api, index);
+                samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - call).count());
+            }
+        }));
+    }
+    for(auto& producer : producers)
+        producer.join();
+
+    // end to end: until the writer thread has written everything.
+    appender->Stop();
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    std::vector<uint32_t> samples;
+    for(auto& thread_samples : latencies)
+        samples.insert(samples.end(), thread_samples.begin(), thread_samples.end());
+
+    Result result;
+    result.api = api;
+    result.appender = appender_name;
+    result.threads = thread_count;
+    result.p50_ns = Percentile(samples, 0.5);
+    result.p99_ns = Percentile(samples, 0.99);
+    result.p999_ns = Percentile(samples, 0.999);
+    result.throughput = samples.size() / seconds;
+
+    Log4CPP::LoggerManager::Instance().Clear();
+    if( appender_name == "file" ){
+        appender.reset();
+        remove(BENCH_FILE);
+    }
+
+    return result;
+}
+
+// cost of a statement below the logger's level.
+double DisabledCost(int events)
+{
+    Log4CPP::LoggerManager::Instance().Clear();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("bench");
+    logger->SetLevel(Log4CPP::Level::ERROR);
+
+    Clock::time_point begin = Clock::now();
+    for(int index = 0; index < events; index++)
+        LOG_DEBUG(logger, "disabled %d", index);
+
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+    Log4CPP::LoggerManager::Instance().Clear();
+    return ns / events;
+}
+
+// cost of a suppressed rate limited statement, no appender attached.
+double SuppressedCost(int events)
+{
+    Log4CPP::LoggerManager::Instance().Clear();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("bench");
+
+    Clock::time_point begin = Clock::now();
+    for(int index = 0; index < events; index++)
+        LOG_FIRST_N(logger, Error, 1, "suppressed %d", index);
+
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+    Log4CPP::LoggerManager::Instance().Clear();
+    return ns / events;
+}
+
+// FormatInto cost of one deferred event into a reused buffer.
+double FormatCost(Log4CPP::Formatter& formatter, int events)
+{
+    Log4CPP::LogEvent e(Log4CPP::Utility::CurrentThreadID(), "bench", Log4CPP::Level::INFO,
+        "benchmark log line {} value {}", 42, 3.5);
+    Log4CPP::LogBuffer buffer;
+
+    Clock::time_point begin = Clock::now();
+    for(int index = 0; index < events; index++){
+        buffer.Clear();
+        formatter.FormatInto(e, buffer);
+    }
+
+    return std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / events;
+}
+
+// ns per KB of clean text: JsonFormatter::Escape against a byte loop.
+double EscapeCost(bool bytes, int runs)
+{
+    const std::string text(1024, 'a');
+    Log4CPP::LogBuffer buffer;
+
+    Clock::time_point begin = Clock::now();
+    for(int run = 0; run < runs; run++){
+        buffer.Clear();
+        if( !bytes ){
+            Log4CPP::JsonFormatter::Escape(text.data(), text.size(), buffer);
+            continue;
+        }
+
+        for(char c : text){
+            if( c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20 )
+                buffer.Append('\\');
+            buffer.Append(c);
+        }
+    }
+
+    return std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / runs;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for(int index = 1; index < argc; index++){
+        const char* arg = argv[index];
+        const char* value = index + 1 < argc ? argv[index + 1] : nullptr;
+
+        if( strcmp(arg, "--events") == 0 && value ){
+            options.events = atoi(value);
+        }else if( strcmp(arg, "--runs") == 0 && value ){
+            options.runs = std::max(1, atoi(value));
+        }else if( strcmp(arg, "--threads") == 0 && value ){
+            options.threads.clear();
+            for(const char* pos = value; *pos; ){
+                options.threads.push_back(atoi(pos));
+                pos = strchr(pos, ',');
+                if( pos == nullptr ) break;
+                pos++;
+            }
+        }else{
+            fprintf(stderr, "usage: %s [--events N] [--threads 1,2,4] [--runs N]\n", argv[0]);
+            return false;
+        }
+        index++;
+    }
+
+    return options.events > 0 && !options.threads.empty();
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if( !ParseOptions(argc, argv, options) )
+        return 1;
+
+    // json goes to the original stdout, console appender to /dev/null.
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    if( out == nullptr || freopen("/dev/null", "w", stdout) == nullptr )
+        return 1;
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+
+    std::vector<Result> results;
+    for(const char* appender : {"console", "file"}){
+        for(Api api : {Api::CSTR, Api::STREAM, Api::MACRO, Api::DEFERRED, Api::CHECKED}){
+            for(int thread_count : options.threads){
+                Result best = RunCase(api, appender, thread_count, options.events);
+                for(int run = 1; run < options.runs; run++){
+                    Result result = RunCase(api, appender, thread_count, options.events);
+                    if( result.throughput > best.throughput )
+                        best = result;
+                }
+                results.push_back(best);
+                fprintf(stderr, "%-8s %-8s %2d threads: p50 %6.0fns p99 %8.0fns p99.9 %8.0fns %10.0f events/s\n",
+                    appender, ApiName(api), thread_count, best.p50_ns, best.p99_ns, best.p999_ns, best.throughput);
+            }
+        }
+    }
+
+    fprintf(out, "{\n  \"version\": 1,\n  \"events_per_case\": %d,\n  \"runs\": %d,\n", options.events, options.runs);
+    Log4CPP::FileFormatter file_formatter;
+    Log4CPP::ConsoleFormatter console_formatter;
+    Log4CPP::PatternFormatter pattern_formatter("[%d] [%t] %p %m");
+    Log4CPP::JsonFormatter json_formatter;
+    fprintf(out, "  \"disabled_ns\": %.2f,\n", DisabledCost(1000000));
+    fprintf(out, "  \"suppressed_ns\": %.2f,\n", SuppressedCost(1000000));
+    fprintf(out, "  \"format_ns\": {\"file\": %.1f, \"console\": %.1f, \"pattern\": %.1f, \"json\": %.1f},\n",
+        FormatCost(file_formatter, 1000000), FormatCost(console_formatter, 1000000),
+        FormatCost(pattern_formatter, 1000000), FormatCost(json_formatter, 1000000));
+    fprintf(out, "  \"escape_ns_per_kb\": {\"escape\": %.1f, \"bytes\": %.1f},\n",
+        EscapeCost(false, 100000), EscapeCost(true, 100000));
+    fprintf(out, "  \"results\": [\n");
+    for(size_t index = 0; index < results.size(); index++){
+        const Result& result = results[index];
+        fprintf(out, "    {\"api\": \"%s\", \"appender\": \"%s\", \"threads\": %d, "
+            "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, \"throughput\": %.0f}%s\n",
+            ApiName(result.api), result.appender.c_str(), result.threads,
+            result.p50_ns, result.p99_ns, result.p999_ns, result.throughput,
+            index + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+
+    return 0;
+}
@@ -3,20 +3,50 @@
 #include <cassert>
 #include <errno.h>
 #include <sys/signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#ifdef LOG4CPP_WITH_ZLIB
+#include <zlib.h>
+#endif
 #include <typeinfo>
 
 #include <chrono>
+#include <thread>
 #include <string>
 #include <vector>
+#include <set>
+#include <mutex>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iterator>
 
 #include "log4cpp.h"
 #include "loghelper.h"
+#include "logdecoder.h"
+#include "logconfig.h"
 
 const char* PROMPT_STR = ">> ";
 #define TEST_PROMPT(func) printf("[%s] --- RUNNING\n", func);
 #define ERR_PROMPT() printf("line:%d, error:%s.\n", __LINE__, ex.what());
 
+// heap allocations made by the current thread, see TestFormatInto.
+thread_local size_t allocation_count = 0;
+
+void* operator new(size_t size)
+{
+    allocation_count++;
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if( ptr == nullptr )
+        throw std::bad_alloc();
+
+    return ptr;
+}
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
 void TestConstructConsoleFormatter()
 {
     TEST_PROMPT(__FUNCTION__);
@@ -294,9 +324,1933 @@ void TestHelper()
     console_appender->Stop();
 }
 
+void TestRingQueue()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    const int producer_count = 4;
+    const int count_per_producer = 10000;
+
+    Log4CPP::RingQueue<int> queue(100);
+    assert(queue.Capacity() == 128);
+    assert(queue.Empty());
+
+    std::vector<std::thread> producers;
+    for(int id = 0; id < producer_count; id++){
+        producers.push_back(std::thread([&queue, id]{
+            for(int index = 0; index < count_per_producer; index++){
+                int value = id * count_per_producer + index;
+                while( !queue.TryPush(std::move(value)) )
+                    std::this_thread::yield();
+            }
+        }));
+    }
+
+    // values of one producer must come out in order.
+    std::vector<int> last(producer_count, -1);
+    int value = 0;
+    for(int popped = 0; popped < producer_count * count_per_producer; ){
+        if( !queue.TryPop(value) ){
+            std::this_thread::yield();
+            continue;
+        }
+
+        int id = value / count_per_producer;
+        assert(value % count_per_producer > last[id]);
+        last[id] = value % count_per_producer;
+        popped++;
+    }
+
+    for(auto& producer : producers)
+        producer.join();
+
+    assert(queue.Empty());
+    assert(!queue.TryPop(value));
+}
+
+class LineCountAppender
+    : public Log4CPP::Appender
+{
+public:
+    ~LineCountAppender()
+    {
+        Stop();
+    }
+
+    std::vector<std::string> _lines;
+
+private:
+    // only the single line Output, batches must fall back to it.
+    void Output(const std::string& log_str) override
+    {
+        _lines.push_back(log_str);
+    }
+};
+
+void TestAppendBatch()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::LogBatch batch;
+    batch.Add("first");
+    batch.Add("second");
+    assert(batch.Count() == 2);
+    assert(batch.Record(1) == "second");
+    assert(std::string(batch.Data(), batch.Size()) == "first\nsecond\n");
+    batch.Clear();
+    assert(batch.Empty() && batch.Size() == 0);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(formatter);
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("batch");
+    logger->AddAppender(appender);
+
+    const int count = 10000;
+    for(int index = 0; index < count; index++)
+        logger->Info() << "batch log " << index << Log4CPP::Endl;
+
+    appender->Stop();
+    assert(appender->_lines.size() == count);
+    assert(appender->_lines.back().find("batch log 9999") != std::string::npos);
+}
+
+void TestDeferredFormat()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    // the format outlives the call only as a literal.
+    static_assert(std::is_constructible<Log4CPP::LogFormat, const char (&)[6]>::value, "literal format");
+    static_assert(!std::is_constructible<Log4CPP::LogFormat, const char*>::value, "runtime format");
+    static_assert(!std::is_constructible<Log4CPP::LogFormat, char (&)[6]>::value, "buffer format");
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(formatter);
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("deferred");
+    logger->AddAppender(appender);
+
+    const std::string name("deferred");
+    const std::string long_text(100, 'x');
+    logger->Info("{} {} {}", 1, "two", 3.5);
+    logger->Warn("{}:{} {{}} {}", name, -7ll, true);
+    logger->Error("{} {}", 'c');
+    logger->Debug("{}", long_text);
+
+    appender->Stop();
+    assert(appender->_lines.size() == 4);
+    assert(appender->_lines[0].find("[INFO]  1 two 3.500000") != std::string::npos);
+    assert(appender->_lines[1].find("deferred:-7 {} true") != std::string::npos);
+    assert(appender->_lines[2].find("c {}") != std::string::npos);
+    assert(appender->_lines[3].find(long_text) != std::string::npos);
+}
+
+static std::string ReferenceTimestamp(const timeval& tv)
+{
+    time_t now = tv.tv_sec;
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+
+    char time_str[32] = {0};
+    size_t len = strftime(time_str, sizeof(time_str), "%Y%m%d-%H:%M:%S", &tm_now);
+    sprintf(time_str + len, ".%03d", (int)(tv.tv_usec/1000));
+    return time_str;
+}
+
+static std::string CachedTimestamp(const timeval& tv)
+{
+    char time_str[Log4CPP::TimestampCache::MAX_LENGTH];
+    size_t len = Log4CPP::TimestampCache::Render(tv, time_str);
+    return std::string(time_str, len);
+}
+
+void TestTimestampCache()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    timeval tv;
+    gettimeofday(&tv, NULL);
+
+    // same second, different milliseconds, then roll over.
+    for(int usec : {0, 999, 1000, 123456, 999999}){
+        tv.tv_usec = usec;
+        assert(CachedTimestamp(tv) == ReferenceTimestamp(tv));
+    }
+    tv.tv_sec += 1;
+    assert(CachedTimestamp(tv) == ReferenceTimestamp(tv));
+    tv.tv_sec += 3600;
+    assert(CachedTimestamp(tv) == ReferenceTimestamp(tv));
+
+    // timezone change within the same second.
+    const char* old_tz = getenv("TZ");
+    std::string saved_tz(old_tz ? old_tz : "");
+
+    setenv("TZ", "UTC0", 1);
+    Log4CPP::TimestampCache::InvalidateTimezone();
+    std::string utc = CachedTimestamp(tv);
+    assert(utc == ReferenceTimestamp(tv));
+
+    setenv("TZ", "XXX-5", 1);
+    Log4CPP::TimestampCache::InvalidateTimezone();
+    std::string shifted = CachedTimestamp(tv);
+    assert(shifted == ReferenceTimestamp(tv));
+    assert(shifted != utc);
+
+    if( old_tz ) setenv("TZ", saved_tz.c_str(), 1);
+    else unsetenv("TZ");
+    Log4CPP::TimestampCache::InvalidateTimezone();
+    tzset();
+}
+
+void TestLoggerLevel()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(formatter);
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("level");
+    logger->AddAppender(appender);
+    assert(logger->IsEnabled(Log4CPP::Level::DEBUG));
+
+    logger->SetLevel(Log4CPP::Level::WARN);
+    assert(!logger->IsEnabled(Log4CPP::Level::INFO));
+    assert(logger->IsEnabled(Log4CPP::Level::WARN));
+
+    // the global level applies on top of the logger's own.
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ERROR);
+    assert(!logger->IsEnabled(Log4CPP::Level::WARN));
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::OFF);
+    assert(!logger->IsEnabled(Log4CPP::Level::FATAL));
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    assert(logger->IsEnabled(Log4CPP::Level::WARN));
+
+    int evaluated = 0;
+    LOG_INFO(logger, "never formatted %d", ++evaluated);
+    LOG_WARN(logger, "formatted %d", ++evaluated);
+    assert(evaluated == 1);
+
+    // disabled path cost, informational only.
+    const int count = 1000000;
+    auto begin = std::chrono::steady_clock::now();
+    for(int index = 0; index < count; index++)
+        LOG_DEBUG(logger, "disabled %d", index);
+    auto end = std::chrono::steady_clock::now();
+    printf("%s disabled LOG_DEBUG: %.2f ns/call\n", PROMPT_STR,
+        std::chrono::duration<double, std::nano>(end - begin).count() / count);
+
+    appender->Stop();
+    assert(appender->_lines.size() == 1);
+    assert(appender->_lines[0].find("formatted 1") != std::string::npos);
+}
+
+// blocks the writer thread in Output until opened.
+class GateAppender
+    : public Log4CPP::Appender
+{
+public:
+    ~GateAppender()
+    {
+        Open();
+        Stop();
+    }
+
+    void Open() { _open = true; }
+    void WaitEntered()
+    {
+        while( !_entered ) std::this_thread::yield();
+    }
+
+    std::vector<std::string> _lines;
+
+private:
+    void Output(const std::string& log_str) override
+    {
+        _entered = true;
+        while( !_open ) std::this_thread::yield();
+        _lines.push_back(log_str);
+    }
+
+    std::atomic_bool _entered{false};
+    std::atomic_bool _open{false};
+};
+
+static std::shared_ptr<GateAppender> RunOverflow(Log4CPP::OverflowPolicy policy)
+{
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::shared_ptr<GateAppender> appender(new GateAppender);
+    appender->SetFormatter(formatter);
+    appender->SetQueueCapacity(4);
+    appender->SetOverflowPolicy(policy, Log4CPP::Level::WARN);
+    appender->Start();
+
+    Log4CPP::LoggerManager::Instance().Clear();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("overflow");
+    logger->AddAppender(appender);
+
+    logger->Info("first");
+    appender->WaitEntered();
+
+    // 4 fit in the queue, the other 6 overflow.
+    for(int index = 0; index < 10; index++)
+        logger->Info("event {}", index);
+
+    appender->Open();
+    appender->Stop();
+    return appender;
+}
+
+// a writer slower than its producers, the queue refills while formatting.
+class SlowFormatter
+    : public Log4CPP::FileFormatter
+{
+public:
+    void FormatInto(const Log4CPP::LogEvent& e, Log4CPP::LogBuffer& out) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        Log4CPP::FileFormatter::FormatInto(e, out);
+    }
+};
+
+// asserts it is still alive whenever it formats.
+class LiveFormatter
+    : public Log4CPP::FileFormatter
+{
+public:
+    LiveFormatter()
+    {
+        std::lock_guard<std::mutex> lock(_live_mtx);
+        _live.insert(this);
+    }
+    ~LiveFormatter()
+    {
+        std::lock_guard<std::mutex> lock(_live_mtx);
+        _live.erase(this);
+    }
+
+    void FormatInto(const Log4CPP::LogEvent& e, Log4CPP::LogBuffer& out) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_live_mtx);
+            assert(_live.count(this) == 1);
+        }
+        Log4CPP::FileFormatter::FormatInto(e, out);
+    }
+
+private:
+    static std::mutex _live_mtx;
+    static std::set<const void*> _live;
+};
+
+std::mutex LiveFormatter::_live_mtx;
+std::set<const void*> LiveFormatter::_live;
+
+class SlowAppender
+    : public Log4CPP::Appender
+{
+public:
+    ~SlowAppender() { Stop(); }
+
+    bool Reported()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _reported;
+    }
+
+private:
+    void Output(const std::string& log_str) override
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _reported = _reported || log_str.find("messages dropped") != std::string::npos;
+    }
+
+    std::mutex _mtx;
+    bool _reported{false};
+};
+
+void TestOverflowPolicy()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    assert(Log4CPP::Configure::Instance().GetOverflowPolicy() == Log4CPP::OverflowPolicy::BLOCK);
+
+    std::shared_ptr<GateAppender> appender = RunOverflow(Log4CPP::OverflowPolicy::DROP_NEWEST);
+    assert(appender->GetQueueCapacity() == 4);
+    assert(appender->GetDroppedCount(Log4CPP::Level::INFO) == 6);
+    assert(appender->_lines.size() == 6);
+    assert(appender->_lines[4].find("event 3") != std::string::npos);
+    assert(appender->_lines[5].find("6 messages dropped (INFO:6)") != std::string::npos);
+
+    appender = RunOverflow(Log4CPP::OverflowPolicy::DROP_OLDEST);
+    assert(appender->GetDroppedCount(Log4CPP::Level::INFO) == 6);
+    assert(appender->_lines.size() == 6);
+    assert(appender->_lines[1].find("event 6") != std::string::npos);
+    assert(appender->_lines[4].find("event 9") != std::string::npos);
+
+    appender = RunOverflow(Log4CPP::OverflowPolicy::DROP_BELOW_LEVEL);
+    assert(appender->GetDroppedCount(Log4CPP::Level::INFO) == 6);
+
+    try{
+        appender->Start();
+        appender->SetQueueCapacity(8);
+        assert(false);
+    }catch(std::logic_error& ex){
+    }
+    appender->Stop();
+
+    // drops are reported under sustained overload too, not only once drained.
+    std::shared_ptr<SlowAppender> slow(new SlowAppender);
+    slow->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new SlowFormatter));
+    slow->SetQueueCapacity(4);
+    slow->SetOverflowPolicy(Log4CPP::OverflowPolicy::DROP_NEWEST, Log4CPP::Level::WARN);
+    slow->Start();
+
+    Log4CPP::LoggerManager::Instance().Clear();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("overload");
+    logger->AddAppender(slow);
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(1500);
+    while( !slow->Reported() && std::chrono::steady_clock::now() < end )
+        logger->Info("overload");
+    assert(slow->Reported());
+
+    slow->Stop();
+
+    // the dropped line is formatted under the formatter guard too.
+    std::shared_ptr<SlowAppender> swapped(new SlowAppender);
+    swapped->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new LiveFormatter));
+    swapped->SetQueueCapacity(4);
+    swapped->SetOverflowPolicy(Log4CPP::OverflowPolicy::DROP_NEWEST, Log4CPP::Level::WARN);
+    swapped->Start();
+
+    Log4CPP::LoggerManager::Instance().Clear();
+    logger = Log4CPP::Logger::GetLogger("overload");
+    logger->AddAppender(swapped);
+
+    std::atomic_bool swapping{true};
+    std::thread swapper([&]{
+        while( swapping )
+            swapped->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new LiveFormatter));
+    });
+
+    end = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+    while( std::chrono::steady_clock::now() < end )
+        logger->Info("overload");
+
+    swapping = false;
+    swapper.join();
+    swapped->Stop();
+    assert(swapped->Reported());
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+static std::string ReadFile(const std::string& file_path)
+{
+    std::ifstream file(file_path);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static std::vector<std::string> ReadLines(const std::string& file_path)
+{
+    std::ifstream file(file_path);
+    std::vector<std::string> lines;
+    std::string line;
+    while( std::getline(file, line) )
+        lines.push_back(line);
+    return lines;
+}
+
+void TestMmapFileAppender()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure& cfg = Log4CPP::Configure::Instance();
+    cfg.SetLowestLevel(Log4CPP::Level::ALL);
+    cfg.SetBackupCount(2);
+    cfg.SetLogFileMaxSize(1);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    const char* file_path = "test_mmap.log";
+    remove(file_path);
+    remove("test_mmap.log.1");
+    remove("test_mmap.log.2");
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    {
+        std::shared_ptr<Log4CPP::MmapFileAppender> appender(new Log4CPP::MmapFileAppender(file_path));
+        appender->SetFormatter(formatter);
+        appender->Start();
+
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("mmap");
+        logger->AddAppender(appender);
+        logger->Info("first {}", 1);
+        logger->Info("second {}", 2);
+        appender->Stop();
+        Log4CPP::LoggerManager::Instance().Clear();
+    }
+
+    // truncated to the real length on close.
+    std::string content = ReadFile(file_path);
+    assert(content.find('\0') == std::string::npos);
+    assert(content.find("first 1\n") != std::string::npos);
+    assert(content.size() > 0 && content.back() == '\n' && content.find("second 2\n") + 9 == content.size());
+
+    // reopen appends, then rotate past 1MB.
+    {
+        std::shared_ptr<Log4CPP::MmapFileAppender> appender(new Log4CPP::MmapFileAppender(file_path));
+        appender->SetFormatter(formatter);
+        appender->Start();
+
+        Log4CPP::LoggerManager::Instance().Clear();
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("mmap");
+        logger->AddAppender(appender);
+
+        const std::string text(200, 'm');
+        // ~1.5MB, rotates exactly once whatever the batch boundaries.
+        for(int index = 0; index < 6000; index++)
+            logger->Info("{} {}", index, text);
+        appender->Stop();
+        Log4CPP::LoggerManager::Instance().Clear();
+    }
+
+    std::string backup = ReadFile("test_mmap.log.1");
+    assert(backup.find("first 1\n") != std::string::npos);
+    assert(backup.size() >= 1024 * 1024 && backup.back() == '\n');
+    content = ReadFile(file_path);
+    assert(content.find('\0') == std::string::npos);
+    assert(content.find(" 5999 ") != std::string::npos);
+
+    remove(file_path);
+    remove("test_mmap.log.1");
+    remove("test_mmap.log.2");
+    cfg.SetBackupCount(0);
+    cfg.SetLogFileMaxSize(3);
+}
+
+void TestSharedExecutor()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<Log4CPP::LogExecutor> executor(new Log4CPP::LogExecutor(2));
+    assert(executor->ThreadCount() == 2);
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::vector<std::shared_ptr<LineCountAppender>> appenders;
+    std::vector<std::shared_ptr<Log4CPP::Logger>> loggers;
+    for(int index = 0; index < 5; index++){
+        std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+        appender->SetFormatter(formatter);
+        appender->SetExecutor(executor);
+        appender->Start();
+        appenders.push_back(appender);
+
+        std::string name("executor");
+        name.append(std::to_string(index));
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger(name.c_str());
+        logger->AddAppender(appender);
+        loggers.push_back(logger);
+    }
+
+    std::vector<std::thread> producers;
+    for(auto& logger : loggers){
+        producers.push_back(std::thread([logger]{
+            for(int index = 0; index < 2000; index++)
+                logger->Info("executor log {}", index);
+        }));
+    }
+    for(auto& producer : producers)
+        producer.join();
+
+    for(auto& appender : appenders){
+        appender->Stop();
+        assert(appender->_lines.size() == 2000);
+        for(int index = 0; index < 2000; index++){
+            std::string expected("executor log ");
+            expected.append(std::to_string(index));
+            assert(appender->_lines[index].find(expected) != std::string::npos);
+        }
+
+        try{
+            appender->SetExecutor(nullptr);
+        }catch(std::logic_error& ex){
+            assert(false);
+        }
+    }
+}
+
+#ifdef LOG4CPP_WITH_ZLIB
+void TestBackupCompress()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure& cfg = Log4CPP::Configure::Instance();
+    cfg.SetLowestLevel(Log4CPP::Level::ALL);
+    cfg.SetBackupCount(2);
+    cfg.SetLogFileMaxSize(1);
+    cfg.SetBackupCompress(true);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    const char* file_path = "test_gz.log";
+    const char* backups[] = {"test_gz.log.1.gz", "test_gz.log.2.gz", "test_gz.log.3.gz"};
+    remove(file_path);
+    for(auto backup : backups)
+        remove(backup);
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::shared_ptr<Log4CPP::FileAppender> appender(new Log4CPP::FileAppender(file_path));
+    appender->SetFormatter(formatter);
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("gz");
+    logger->AddAppender(appender);
+
+    // ~3.5MB, 3 rotations, only 2 backups kept.
+    const std::string text(200, 'z');
+    for(int index = 0; index < 14000; index++)
+        logger->Info("{} {}", index, text);
+
+    appender->Stop();
+    Log4CPP::BackupCompressor::Instance().Wait();
+
+    struct stat file_stat;
+    assert(stat(backups[0], &file_stat) == 0);
+    assert(stat(backups[1], &file_stat) == 0);
+    assert(stat(backups[2], &file_stat) != 0);
+
+    gzFile backup = gzopen(backups[0], "rb");
+    assert(backup != nullptr);
+    std::string content;
+    char buffer[4096];
+    int len = 0;
+    while( (len = gzread(backup, buffer, sizeof(buffer))) > 0 )
+        content.append(buffer, len);
+    gzclose(backup);
+
+    assert(content.size() >= 1024 * 1024 && content.back() == '\n');
+    assert(content.find(text) != std::string::npos);
+
+    // pending files left behind by a crash, one compressed, one not.
+    Log4CPP::LoggerManager::Instance().Clear();
+    appender.reset();
+    {
+        std::ofstream("test_gz.log.rotating.0") << "left raw\n";
+        gzFile left = gzopen("test_gz.log.rotating.1.gz", "wb");
+        gzputs(left, "left gz\n");
+        gzclose(left);
+
+        Log4CPP::FileAppender recovered(file_path);
+        Log4CPP::BackupCompressor::Instance().Wait();
+
+        assert(stat("test_gz.log.rotating.0", &file_stat) != 0);
+        assert(stat("test_gz.log.rotating.0.gz", &file_stat) != 0);
+        assert(stat("test_gz.log.rotating.1.gz", &file_stat) != 0);
+
+        std::string recovered_content;
+        for(int index = 0; index < 2; index++){
+            backup = gzopen(backups[index], "rb");
+            assert(backup != nullptr);
+            while( (len = gzread(backup, buffer, sizeof(buffer))) > 0 )
+                recovered_content.append(buffer, len);
+            gzclose(backup);
+        }
+        assert(recovered_content == "left gz\nleft raw\n");
+    }
+
+    remove(file_path);
+    for(auto backup : backups)
+        remove(backup);
+
+    cfg.SetBackupCompress(false);
+    cfg.SetBackupCount(0);
+    cfg.SetLogFileMaxSize(3);
+}
+#else
+void TestBackupCompress()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    try{
+        Log4CPP::Configure::Instance().SetBackupCompress(true);
+        assert(false);
+    }catch(std::invalid_argument& ex){
+    }
+    assert(!Log4CPP::Configure::Instance().GetBackupCompress());
+}
+#endif
+
+void TestMetrics()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::LatencyHistogram histogram;
+    assert(histogram.Percentile(0.5) == 0);
+    histogram.Add(Log4CPP::LatencyHistogram::BucketOf(100), 99);
+    histogram.Add(Log4CPP::LatencyHistogram::BucketOf(5000), 1);
+    assert(histogram.Count() == 100);
+    assert(histogram.Percentile(0.5) == 127);
+    assert(histogram.Percentile(0.999) == 8191);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new Log4CPP::FileFormatter));
+    appender->Start();
+
+    // one appender shared by two loggers is reported once.
+    std::shared_ptr<Log4CPP::Logger> first = Log4CPP::Logger::GetLogger("metrics1");
+    std::shared_ptr<Log4CPP::Logger> second = Log4CPP::Logger::GetLogger("metrics2");
+    first->AddAppender(appender);
+    second->AddAppender(appender);
+    for(int index = 0; index < 1000; index++){
+        first->Info("metrics {}", index);
+        second->Info("metrics {}", index);
+    }
+    appender->Stop();
+
+    std::vector<Log4CPP::AppenderMetrics> snapshot = Log4CPP::LoggerManager::Instance().SnapshotMetrics();
+    assert(snapshot.size() == 1);
+
+    const Log4CPP::AppenderMetrics& metrics = snapshot[0];
+    assert(metrics.name == "appender");
+    assert(metrics.queue_capacity == appender->GetQueueCapacity());
+    assert(metrics.queue_depth == 0);
+    assert(metrics.queue_peak > 0 && metrics.queue_peak <= metrics.queue_capacity);
+    assert(metrics.enqueued == 2000);
+    assert(metrics.enqueue_latency.Count() > 0 && metrics.enqueue_latency.Count() <= 2000);
+    assert(metrics.lines == 2000);
+    assert(metrics.bytes > 2000 * strlen("metrics 0\n"));
+    assert(metrics.rotations == 0);
+    for(uint64_t dropped : metrics.dropped)
+        assert(dropped == 0);
+
+    Log4CPP::FileAppender file_appender("test_metrics.log");
+    assert(file_appender.GetMetrics().name.find("test_metrics.log") != std::string::npos);
+    assert(Log4CPP::ConsoleAppender::Get()->GetMetrics().name == "console");
+    file_appender.Stop();
+    remove(file_appender.GetMetrics().name.c_str());
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+void TestThreadContext()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    assert(Log4CPP::Utility::CurrentThreadID() == static_cast<unsigned int>(syscall(SYS_gettid)));
+    unsigned int main_tid = Log4CPP::Utility::CurrentThreadID();
+    std::thread([main_tid]{
+        assert(Log4CPP::Utility::CurrentThreadID() == static_cast<unsigned int>(syscall(SYS_gettid)));
+        assert(Log4CPP::Utility::CurrentThreadID() != main_tid);
+    }).join();
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new Log4CPP::FileFormatter));
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("context");
+    logger->AddAppender(appender);
+
+    assert(!Log4CPP::ThreadContext::Tag());
+    logger->Info("plain");
+
+    std::thread([logger]{
+        Log4CPP::ThreadContext::SetThreadName("worker");
+        Log4CPP::ThreadContext::Put("request", "42");
+        {
+            Log4CPP::ScopedContext scope("user", "bob");
+            logger->Info("scoped {}", 1);
+        }
+        assert(Log4CPP::ThreadContext::Get("user").empty());
+        {
+            // a nested scope of the same key gives the outer value back.
+            Log4CPP::ScopedContext outer("request", "44");
+            {
+                Log4CPP::ScopedContext inner("request", "45");
+                assert(Log4CPP::ThreadContext::Get("request") == "45");
+            }
+            assert(Log4CPP::ThreadContext::Get("request") == "44");
+        }
+        std::string request;
+        assert(Log4CPP::ThreadContext::Get("request", request) && request == "42");
+        Log4CPP::ThreadContext::Put("request", "43");
+        logger->Info("named");
+        Log4CPP::ThreadContext::Clear();
+    }).join();
+
+    // the main thread is not tagged by the worker.
+    assert(!Log4CPP::ThreadContext::Tag());
+    appender->Stop();
+
+    assert(appender->_lines.size() == 3);
+    assert(appender->_lines[0].find("|") == std::string::npos && appender->_lines[0].find("{") == std::string::npos);
+    assert(appender->_lines[1].find("|worker] ") != std::string::npos);
+    assert(appender->_lines[1].find("{request=42 user=bob} scoped 1") != std::string::npos);
+    assert(appender->_lines[2].find("{request=43} named") != std::string::npos);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+class HeaderFormatter
+    : public Log4CPP::Formatter
+{
+private:
+    // written against the older FormatHeader only.
+    std::string FormatHeader(const Log4CPP::LogEvent& e) override
+    {
+        return std::string("<") + e.Module() + "> ";
+    }
+};
+
+void TestFormatInto()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::ThreadContext::SetThreadName("formatter");
+    Log4CPP::ThreadContext::Put("request", "7");
+    Log4CPP::LogEvent deferred(Log4CPP::Utility::CurrentThreadID(), "format", Log4CPP::Level::INFO,
+        "deferred {} {} {} {}", -42, 18446744073709551615ull, "text", 1.5);
+    deferred.SetThreadTag(Log4CPP::ThreadContext::Tag());
+    Log4CPP::ThreadContext::Clear();
+    Log4CPP::ThreadContext::SetThreadName("");
+
+    Log4CPP::FileFormatter file_formatter;
+    Log4CPP::ConsoleFormatter console_formatter;
+    Log4CPP::LogBuffer buffer;
+    file_formatter.FormatInto(deferred, buffer);
+    console_formatter.FormatInto(deferred, buffer);
+
+    std::string line = file_formatter.Format(deferred);
+    assert(line.find("] [" + std::to_string(Log4CPP::Utility::CurrentThreadID()) + "|formatter] [INFO]  {request=7} ") != std::string::npos);
+    assert(line.find("deferred -42 18446744073709551615 text 1.500000") != std::string::npos);
+    assert(console_formatter.Format(deferred).find("|formatter] [format] [INFO]  {request=7} deferred") != std::string::npos);
+
+    // steady state: the reused buffer is big enough, nothing allocates.
+    for(int index = 0; index < 100; index++){
+        buffer.Clear();
+        size_t before = allocation_count;
+        file_formatter.FormatInto(deferred, buffer);
+        console_formatter.FormatInto(deferred, buffer);
+        assert(allocation_count == before);
+    }
+
+    // migration path: FormatHeader only formatters still work.
+    HeaderFormatter header_formatter;
+    Log4CPP::LogEvent plain(1, "format", Log4CPP::Level::INFO, "plain");
+    assert(header_formatter.Format(plain) == "<format> plain");
+
+    Log4CPP::LogBatch batch;
+    header_formatter.FormatInto(plain, batch.BeginRecord());
+    batch.EndRecord();
+    assert(batch.Count() == 1 && batch.Record(0) == "<format> plain");
+}
+
+void TestPatternFormatter()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::ThreadContext::Put("request", "9");
+    Log4CPP::LogEvent e(Log4CPP::Utility::CurrentThreadID(), "pattern", Log4CPP::Level::WARN, "value {}", 5);
+    e.SetThreadTag(Log4CPP::ThreadContext::Tag());
+    Log4CPP::ThreadContext::Clear();
+
+    char date[64];
+    struct tm local;
+    time_t second = e.Timestamp().tv_sec;
+    localtime_r(&second, &local);
+    char millisecond[4];
+    snprintf(millisecond, sizeof(millisecond), "%03d", (int)(e.Timestamp().tv_usec / 1000));
+    std::string tid = std::to_string(Log4CPP::Utility::CurrentThreadID());
+
+    Log4CPP::PatternFormatter formatter("%d{%H:%M:%S.%e} [%t] %c %p %m");
+    strftime(date, sizeof(date), "%H:%M:%S.", &local);
+    std::string expected = std::string(date) + millisecond + " [" + tid + "] pattern WARN value 5";
+    assert(formatter.Format(e) == expected);
+    // the cached date of this second is reused.
+    assert(formatter.Format(e) == expected);
+
+    // plain %d is the layout of FileFormatter.
+    Log4CPP::PatternFormatter default_date("%d");
+    strftime(date, sizeof(date), "%Y%m%d-%H:%M:%S.", &local);
+    assert(default_date.Format(e) == std::string(date) + millisecond);
+
+    // other strftime fields, microseconds, name, context and escapes.
+    Log4CPP::PatternFormatter others("%d{%a %Y|%f} %T {%X} 100%% %m%%");
+    strftime(date, sizeof(date), "%a %Y|", &local);
+    char microsecond[8];
+    snprintf(microsecond, sizeof(microsecond), "%06d", (int)e.Timestamp().tv_usec);
+    assert(others.Format(e) == std::string(date) + microsecond + " " + tid + " {request=9} 100% value 5%");
+
+    Log4CPP::PatternFormatter literal("no conversions");
+    assert(literal.Format(e) == "no conversions");
+
+    for(const char* pattern : {"%q", "%d{%H", "%", "%d{%}"}){
+        try{
+            Log4CPP::PatternFormatter invalid(pattern);
+            assert(false);
+        }catch(std::invalid_argument& ex){
+        }
+    }
+
+    // end to end, shared by appenders.
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<Log4CPP::Formatter> shared(new Log4CPP::PatternFormatter("%p|%c|%m"));
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(shared);
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("pattern");
+    logger->AddAppender(appender);
+    logger->Info("line {}", 1);
+    logger->Error("line 2");
+    appender->Stop();
+
+    assert(appender->_lines.size() == 2);
+    assert(appender->_lines[0] == "INFO|pattern|line 1");
+    assert(appender->_lines[1] == "ERROR|pattern|line 2");
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+void TestCheckedFormat()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    static_assert(Log4CPP::FormatCheck::Placeholders("") == 0, "empty");
+    static_assert(Log4CPP::FormatCheck::Placeholders("{} and {}") == 2, "two");
+    static_assert(Log4CPP::FormatCheck::Placeholders("{{}} {}") == 1, "escaped");
+    static_assert(Log4CPP::FormatCheck::Placeholders("lone {") == -1, "lone open");
+    static_assert(Log4CPP::FormatCheck::Placeholders("lone } here") == -1, "lone close");
+    static_assert(decltype(Log4CPP::FormatCheck::Count(1, "a", 2.0f))::value == 3, "count");
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new Log4CPP::PatternFormatter("%m")));
+    appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("checked");
+    logger->AddAppender(appender);
+
+    float ratio = 0.5f;
+    LOGF_INFO(logger, "user {} ratio {} {{ok}}", std::string("bob"), ratio);
+    LOGF_ERROR(logger, "no arguments {{}}");
+
+    // printf lines are no longer cut at 4096 bytes.
+    std::string text(10000, 'x');
+    LOG_WARN(logger, "long %s end", text.c_str());
+
+    // a caller variable named like a macro local.
+    int line = 42;
+    LOG_INFO(logger, "line %d", line);
+    LOG_FIRST_N(logger, Info, 1, "first line %d", line);
+
+    // braces in the source path are not placeholders.
+#line 1 "odd{dir}/file.cpp"
+    LOGF_INFO(logger, "path {}", 1);
+#line 1262 "test.cpp"
+
+    logger->SetLevel(Log4CPP::Level::ERROR);
+    LOGF_DEBUG(logger, "disabled {}", 1);
+    appender->Stop();
+
+    assert(appender->_lines.size() == 6);
+    assert(appender->_lines[3].find("] line 42") != std::string::npos);
+    assert(appender->_lines[4].find("] first line 42") != std::string::npos);
+    assert(appender->_lines[5] == "[odd{dir}/file.cpp:1][TestCheckedFormat] path 1");
+    assert(appender->_lines[0].find("][TestCheckedFormat] user bob ratio 0.500000 {ok}") != std::string::npos);
+    assert(appender->_lines[0].find("[test.cpp:") == 0);
+    assert(appender->_lines[1].find("] no arguments {}") != std::string::npos);
+    assert(appender->_lines[2].find("long " + text + " end") != std::string::npos);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+std::string JsonEscape(const std::string& text)
+{
+    Log4CPP::LogBuffer buffer;
+    Log4CPP::JsonFormatter::Escape(text.data(), text.size(), buffer);
+    return std::string(buffer.Data(), buffer.Size());
+}
+
+void TestStructuredLog()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    assert(JsonEscape("") == "");
+    assert(JsonEscape("plain utf-8 \xc3\xa9") == "plain utf-8 \xc3\xa9");
+    assert(JsonEscape("a\"b\\c\nd\te\x01") == "a\\\"b\\\\c\\nd\\te\\u0001");
+
+    // a special character at every offset around the 16 byte chunks.
+    for(size_t index = 0; index < 40; index++){
+        std::string text(40, 'x');
+        text[index] = '"';
+        std::string expected(text.substr(0, index) + "\\\"" + text.substr(index + 1));
+        assert(JsonEscape(text) == expected);
+    }
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<LineCountAppender> json_appender(new LineCountAppender);
+    json_appender->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new Log4CPP::JsonFormatter));
+    json_appender->Start();
+    std::shared_ptr<LineCountAppender> text_appender(new LineCountAppender);
+    text_appender->SetFormatter(std::shared_ptr<Log4CPP::Formatter>(new Log4CPP::FileFormatter));
+    text_appender->Start();
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("structured");
+    logger->AddAppender(json_appender);
+    logger->AddAppender(text_appender);
+
+    logger->Info().Kv("user", 42).Kv("name", "bo\"b").Kv("ms", 1.5).Kv("ok", true) << "login" << Log4CPP::Endl;
+    // flushed at the end of the statement.
+    logger->Warn().Kv("nan", 0.0 / 0.0).Kv("big", 18446744073709551615ull);
+    {
+        Log4CPP::ScopedContext request("request", "7");
+        logger->Error("plain \"{}\"", std::string("text"));
+    }
+    json_appender->Stop();
+    text_appender->Stop();
+
+    assert(json_appender->_lines.size() == 3);
+    const std::string& login = json_appender->_lines[0];
+    assert(login.find("{\"ts\":\"") == 0 && login.back() == '}');
+    assert(login.find("\",\"level\":\"INFO\",\"logger\":\"structured\",\"tid\":") != std::string::npos);
+    assert(login.find(",\"msg\":\"login\",\"user\":42,\"name\":\"bo\\\"b\",\"ms\":1.5,\"ok\":true}") != std::string::npos);
+    assert(json_appender->_lines[1].find("\"level\":\"WARN\"") != std::string::npos);
+    assert(json_appender->_lines[1].find(",\"msg\":\"\",\"nan\":null,\"big\":18446744073709551615}") != std::string::npos);
+    assert(json_appender->_lines[2].find(",\"ctx\":\"request=7\",\"msg\":\"plain \\\"text\\\"\"}") != std::string::npos);
+
+    assert(text_appender->_lines.size() == 3);
+    assert(text_appender->_lines[0].find("login user=42 name=bo\"b ms=1.500000 ok=true") != std::string::npos);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+std::vector<std::string> DecodeBinaryLog(const char* file_path, bool& truncated)
+{
+    Log4CPP::BinaryLogReader reader;
+    assert(reader.Open(file_path));
+
+    std::vector<std::string> lines;
+    Log4CPP::FileFormatter formatter;
+    Log4CPP::LogEvent e;
+    while( reader.Next(e) )
+        lines.push_back(formatter.Format(e));
+
+    truncated = reader.Truncated();
+    return lines;
+}
+
+void TestBinaryFileAppender()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure& cfg = Log4CPP::Configure::Instance();
+    cfg.SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    const char* file_path = "test_binary.log";
+    remove(file_path);
+
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    std::shared_ptr<LineCountAppender> text_appender(new LineCountAppender);
+    text_appender->SetFormatter(formatter);
+    text_appender->Start();
+    {
+        std::shared_ptr<Log4CPP::BinaryFileAppender> appender(new Log4CPP::BinaryFileAppender(file_path));
+        appender->Start();
+
+        std::shared_ptr<Log4CPP::Logger> first = Log4CPP::Logger::GetLogger("binary1");
+        std::shared_ptr<Log4CPP::Logger> second = Log4CPP::Logger::GetLogger("binary2");
+        for(auto& logger : {first, second}){
+            logger->AddAppender(appender);
+            logger->AddAppender(text_appender);
+        }
+
+        for(int index = 0; index < 100; index++){
+            first->Info("deferred {} {} {}", index, -1.5, std::string("text"));
+            second->Warn("plain text");
+        }
+        std::thread([first]{
+            Log4CPP::ThreadContext::SetThreadName("worker");
+            Log4CPP::ScopedContext request("request", "5");
+            first->Error().Kv("user", 42).Kv("ok", true) << "fields";
+        }).join();
+
+        appender->Stop();
+        Log4CPP::LoggerManager::Instance().Clear();
+    }
+    text_appender->Stop();
+
+    // decodes to exactly what FileFormatter writes.
+    bool truncated = true;
+    std::vector<std::string> lines = DecodeBinaryLog(file_path, truncated);
+    assert(!truncated);
+    assert(lines == text_appender->_lines);
+    assert(lines.size() == 201 && lines[200].find("|worker] [ERROR] {request=5} fields user=42 ok=true") != std::string::npos);
+
+    // smaller than the text it stands for.
+    std::string content = ReadFile(file_path);
+    size_t text_size = 0;
+    for(auto& line : lines)
+        text_size += line.size() + 1;
+    assert(content.size() < text_size / 2);
+
+    // a torn last record is skipped, then cut off when the file is reopened.
+    truncate(file_path, content.size() - 3);
+    lines = DecodeBinaryLog(file_path, truncated);
+    assert(truncated && lines.size() == 200);
+    {
+        std::shared_ptr<Log4CPP::BinaryFileAppender> appender(new Log4CPP::BinaryFileAppender(file_path));
+        appender->Start();
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("binary3");
+        logger->AddAppender(appender);
+        logger->Info("after {}", "restart");
+        appender->Stop();
+        Log4CPP::LoggerManager::Instance().Clear();
+    }
+    lines = DecodeBinaryLog(file_path, truncated);
+    assert(!truncated && lines.size() == 201);
+    assert(lines[199].find("plain text") != std::string::npos);
+    assert(lines[200].find("after restart") != std::string::npos);
+
+    // an argument running past its record is skipped, the next one is read.
+    {
+        auto record = [](Log4CPP::LogBuffer& out, const std::string& body){
+            Log4CPP::BinaryFormat::PutVarint(out, body.size());
+            out.Append(body.data(), body.size());
+        };
+        Log4CPP::LogBuffer file;
+        file.Append(Log4CPP::BinaryFormat::MAGIC, Log4CPP::BinaryFormat::MAGIC_SIZE);
+        file.Append(static_cast<char>(Log4CPP::BinaryFormat::VERSION));
+        record(file, std::string("\x02\x01module", 8));
+        record(file, std::string("\x02\x02value {}", 10));
+        // STRING argument claiming 1000 bytes, 3 follow.
+        record(file, std::string("\x01\x01\x00\x01\x02\x01\x02\x08\x09\xe8\x03\x00\x00" "abc", 16));
+        record(file, std::string("\x01\x00\x00\x01\x02\x01\x02ok", 9));
+
+        std::ofstream(file_path, std::ios::binary).write(file.Data(), file.Size());
+        Log4CPP::BinaryLogReader reader;
+        assert(reader.Open(file_path));
+        Log4CPP::LogEvent e;
+        assert(reader.Next(e) && e.Text() == std::string("ok"));
+        assert(!reader.Next(e) && !reader.Truncated() && reader.Skipped() == 1);
+    }
+
+    // a thread name rebuilt by every context change is written once.
+    remove(file_path);
+    {
+        std::shared_ptr<Log4CPP::BinaryFileAppender> appender(new Log4CPP::BinaryFileAppender(file_path));
+        appender->Start();
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("binary5");
+        logger->AddAppender(appender);
+        std::thread([logger]{
+            Log4CPP::ThreadContext::SetThreadName("worker");
+            for(int index = 0; index < 100; index++){
+                Log4CPP::ScopedContext request("request", std::to_string(index));
+                logger->Info("request {}", index);
+            }
+            Log4CPP::ThreadContext::SetThreadName("");
+        }).join();
+        // larger than the reader's chunk.
+        logger->Info("{}", std::string(100000, 'x'));
+        appender->Stop();
+        Log4CPP::LoggerManager::Instance().Clear();
+    }
+    content = ReadFile(file_path);
+    size_t names = 0;
+    for(size_t pos = content.find("worker"); pos != std::string::npos; pos = content.find("worker", pos + 1))
+        names++;
+    assert(names == 1);
+    lines = DecodeBinaryLog(file_path, truncated);
+    assert(!truncated && lines.size() == 101 && lines[99].find("|worker] [INFO]  {request=99} request 99") != std::string::npos);
+    assert(lines[100].find(std::string(100000, 'x')) != std::string::npos);
+
+    // every rotated file carries its own string table.
+    cfg.SetBackupCount(1);
+    cfg.SetLogFileMaxSize(1);
+    remove(file_path);
+    remove("test_binary.log.1");
+    {
+        std::shared_ptr<Log4CPP::BinaryFileAppender> appender(new Log4CPP::BinaryFileAppender(file_path));
+        appender->Start();
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("binary4");
+        logger->AddAppender(appender);
+
+        const std::string text(200, 'b');
+        for(int index = 0; index < 8000; index++)
+            logger->Info("{} {}", index, text);
+        appender->Stop();
+        assert(appender->GetMetrics().rotations == 1);
+        Log4CPP::LoggerManager::Instance().Clear();
+    }
+    std::vector<std::string> backup = DecodeBinaryLog("test_binary.log.1", truncated);
+    assert(!truncated && !backup.empty() && backup[0].find(" 0 bbb") != std::string::npos);
+    lines = DecodeBinaryLog(file_path, truncated);
+    assert(!truncated && backup.size() + lines.size() == 8000);
+    assert(lines.back().find(" 7999 bbb") != std::string::npos);
+
+    remove(file_path);
+    remove("test_binary.log.1");
+    cfg.SetBackupCount(0);
+    cfg.SetLogFileMaxSize(3);
+}
+
+void TestAsyncFileAppender()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure& cfg = Log4CPP::Configure::Instance();
+    cfg.SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    const char* file_path = "test_async.log";
+    const char* backup_path = "test_async.log.1";
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+
+    auto write = [&](bool direct_io, bool io_uring, int from, int to, const std::string& text){
+        std::shared_ptr<Log4CPP::AsyncFileAppender> appender(new Log4CPP::AsyncFileAppender(file_path, direct_io, io_uring));
+        assert(io_uring || !appender->UsingIoUring());
+        appender->SetFormatter(formatter);
+        appender->Start();
+
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("async");
+        logger->AddAppender(appender);
+        for(int index = from; index < to; index++)
+            logger->Info("line {} {}", index, text);
+        appender->Stop();
+        Log4CPP::LoggerManager::Instance().Clear();
+        return appender->GetMetrics().rotations;
+    };
+    auto check = [](const char* path, int from, int to){
+        std::vector<std::string> lines = ReadLines(path);
+        assert(lines.size() == static_cast<size_t>(to - from));
+        for(int index = from; index < to; index++)
+            assert(lines[index - from].find("line " + std::to_string(index) + " ") != std::string::npos);
+        std::string content = ReadFile(path);
+        assert(content.back() == '\n' && content.find('\0') == std::string::npos);
+    };
+
+    // every mode appends, also across a restart with a partial last block.
+    for(bool direct_io : {false, true}){
+        for(bool io_uring : {true, false}){
+            remove(file_path);
+            write(direct_io, io_uring, 0, 1000, "async");
+            check(file_path, 0, 1000);
+            write(direct_io, io_uring, 1000, 1003, "restart");
+            check(file_path, 0, 1003);
+        }
+    }
+
+    // zero padding left by a crash in direct mode is skipped.
+    {
+        std::ofstream out(file_path, std::ios::app | std::ios::binary);
+        out << std::string(100, '\0');
+    }
+    write(true, true, 1003, 1004, "padded");
+    check(file_path, 0, 1004);
+
+    // rotation keeps every line in order across the files.
+    cfg.SetBackupCount(1);
+    cfg.SetLogFileMaxSize(1);
+    for(bool direct_io : {false, true}){
+        remove(file_path);
+        remove(backup_path);
+        const std::string text(200, 'a');
+        assert(write(direct_io, true, 0, 8000, text) == 1);
+
+        std::vector<std::string> backup = ReadLines(backup_path);
+        assert(!backup.empty() && ReadFile(backup_path).size() >= 1024 * 1024);
+        check(backup_path, 0, backup.size());
+        check(file_path, backup.size(), 8000);
+    }
+
+    remove(file_path);
+    remove(backup_path);
+    cfg.SetBackupCount(0);
+    cfg.SetLogFileMaxSize(3);
+}
+
+void TestConcurrentGetLogger()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    // every thread sees the same logger per name while the table grows.
+    const int thread_count = 8;
+    const int name_count = 200;
+    std::vector<std::vector<Log4CPP::Logger*>> seen(thread_count);
+    std::vector<std::thread> threads;
+    for(int id = 0; id < thread_count; id++){
+        seen[id].resize(name_count, nullptr);
+        threads.emplace_back([id, &seen]{
+            for(int round = 0; round < 3; round++){
+                for(int index = 0; index < name_count; index++){
+                    int name = (index * 7 + id * 13) % name_count;
+                    Log4CPP::Logger* logger = Log4CPP::Logger::GetLogger("concurrent." + std::to_string(name)).get();
+                    assert(seen[id][name] == nullptr || seen[id][name] == logger);
+                    seen[id][name] = logger;
+                }
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+
+    for(int index = 0; index < name_count; index++){
+        std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger(("concurrent." + std::to_string(index)).c_str());
+        assert(logger->GetName() == "concurrent." + std::to_string(index));
+        for(auto& pointers : seen)
+            assert(pointers[index] == logger.get());
+    }
+
+    // finding an existing logger doesn't allocate.
+    size_t before = allocation_count;
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("concurrent.42");
+#if __cplusplus >= 201703L
+    using namespace std::literals;
+    assert(Log4CPP::Logger::GetLogger("concurrent.42"sv) == logger);
+#endif
+    assert(allocation_count == before);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+    assert(Log4CPP::Logger::GetLogger("concurrent.42") != logger);
+}
+
+void TestLoggerHierarchy()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure& cfg = Log4CPP::Configure::Instance();
+    cfg.SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    // ancestors are created along the way.
+    std::shared_ptr<Log4CPP::Logger> conn = Log4CPP::Logger::GetLogger("db.pool.conn");
+    std::shared_ptr<Log4CPP::Logger> pool = Log4CPP::Logger::GetLogger("db.pool");
+    std::shared_ptr<Log4CPP::Logger> db = Log4CPP::Logger::GetLogger("db");
+    assert(conn->GetParent() == pool && pool->GetParent() == db && !db->GetParent());
+    assert(!Log4CPP::Logger::GetLogger("dbx")->GetParent());
+
+    // levels flow down to the loggers without their own.
+    db->SetLevel(Log4CPP::Level::WARN);
+    assert(conn->GetLevel() == Log4CPP::Level::WARN && !conn->IsEnabled(Log4CPP::Level::INFO));
+    pool->SetLevel(Log4CPP::Level::DEBUG);
+    assert(conn->GetLevel() == Log4CPP::Level::DEBUG && db->GetLevel() == Log4CPP::Level::WARN);
+    conn->SetLevel(Log4CPP::Level::ERROR);
+    pool->SetLevel(Log4CPP::Level::INFO);
+    assert(conn->GetLevel() == Log4CPP::Level::ERROR);
+    conn->ResetLevel();
+    pool->ResetLevel();
+    assert(conn->GetLevel() == Log4CPP::Level::WARN);
+    assert(Log4CPP::Logger::GetLogger("db.pool.conn2")->GetLevel() == Log4CPP::Level::WARN);
+
+    // the global lowest level still applies on top.
+    cfg.SetLowestLevel(Log4CPP::Level::ERROR);
+    assert(!conn->IsEnabled(Log4CPP::Level::WARN));
+    cfg.SetLowestLevel(Log4CPP::Level::ALL);
+    assert(conn->IsEnabled(Log4CPP::Level::WARN));
+
+    // events reach the ancestors' appenders unless additivity is off.
+    std::shared_ptr<LineCountAppender> db_appender(new LineCountAppender);
+    std::shared_ptr<LineCountAppender> conn_appender(new LineCountAppender);
+    std::shared_ptr<Log4CPP::Formatter> formatter(new Log4CPP::FileFormatter);
+    for(auto& appender : {db_appender, conn_appender}){
+        appender->SetFormatter(formatter);
+        appender->Start();
+    }
+    db->AddAppender(db_appender);
+    conn->AddAppender(conn_appender);
+
+    conn->Warn("both");
+    conn->Info("filtered");
+    pool->Error("db only");
+    conn->SetAdditivity(false);
+    conn->Error("conn only");
+    db_appender->Stop();
+    conn_appender->Stop();
+
+    assert(db_appender->_lines.size() == 2);
+    assert(db_appender->_lines[0].find("[WARN]  both") != std::string::npos);
+    assert(db_appender->_lines[1].find("[ERROR] db only") != std::string::npos);
+    assert(conn_appender->_lines.size() == 2);
+    assert(conn_appender->_lines[1].find("conn only") != std::string::npos);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+static void WriteConfig(const char* file_path, const std::string& content)
+{
+    // replaced by rename, like editors do.
+    std::string temp_path = std::string(file_path) + ".tmp";
+    {
+        std::ofstream out(temp_path);
+        out << content;
+    }
+    rename(temp_path.c_str(), file_path);
+}
+
+void TestConfigWatcher()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    // bad files name the line.
+    try{
+        std::stringstream in("logger.x = LOUD");
+        Log4CPP::ConfigSnapshot::Parse(in);
+        assert(false);
+    }catch(std::invalid_argument& ex){
+        assert(std::string(ex.what()).find("line 1") != std::string::npos);
+    }
+    try{
+        std::stringstream in("logger.x = INFO, nowhere");
+        Log4CPP::ConfigSnapshot::Parse(in);
+        assert(false);
+    }catch(std::invalid_argument& ex){
+    }
+
+    // refused by the parse, not half way through the apply.
+    {
+        std::stringstream in("backup_count = 2\nbackup_compress = true");
+#ifdef LOG4CPP_WITH_ZLIB
+        assert(Log4CPP::ConfigSnapshot::Parse(in)->backup_compress);
+#else
+        try{
+            Log4CPP::ConfigSnapshot::Parse(in);
+            assert(false);
+        }catch(std::invalid_argument& ex){
+            assert(std::string(ex.what()).find("line 2") != std::string::npos);
+        }
+#endif
+    }
+
+    const char* config_path = "test_config.properties";
+    const char* log_path = "test_config.log";
+    remove(log_path);
+    WriteConfig(config_path,
+        "# first version\n"
+        "appender.main = file test_config.log\n"
+        "logger.cfg = INFO, main\n"
+        "logger.cfg.quiet = ERROR\n");
+
+    Log4CPP::ConfigWatcher watcher(config_path);
+    watcher.Start();
+    assert(watcher.Generation() == 1);
+
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("cfg");
+    std::shared_ptr<Log4CPP::Logger> quiet = Log4CPP::Logger::GetLogger("cfg.quiet");
+    std::shared_ptr<Log4CPP::Appender> main = watcher.GetAppender("main");
+    assert(logger->GetLevel() == Log4CPP::Level::INFO && quiet->GetLevel() == Log4CPP::Level::ERROR);
+    assert(logger->GetAppenders().size() == 1 && logger->GetAppenders()[0] == main);
+
+    // reload while another thread logs: nothing is lost.
+    const int count = 20000;
+    std::thread producer([logger]{
+        for(int index = 0; index < count; index++)
+            logger->Info("event {}", index);
+    });
+
+    WriteConfig(config_path,
+        "backup_count = 1\n"
+        "appender.main = file test_config.log\n"
+        "appender.main.formatter = pattern %p %m\n"
+        "logger.cfg = DEBUG, main\n");
+    for(int wait = 0; wait < 500 && watcher.Generation() < 2; wait++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(watcher.Generation() == 2);
+    producer.join();
+
+    assert(watcher.GetAppender("main") == main);
+    assert(logger->GetLevel() == Log4CPP::Level::DEBUG && quiet->GetLevel() == Log4CPP::Level::DEBUG);
+    assert(Log4CPP::Configure::Instance().GetBackupCount() == 1);
+    logger->Debug("after {}", "reload");
+
+    // a broken file keeps the current config.
+    WriteConfig(config_path, "logger.cfg = LOUD\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    assert(watcher.Generation() == 2 && logger->GetLevel() == Log4CPP::Level::DEBUG);
+
+    // so does a bad pattern, none of the file is applied.
+    WriteConfig(config_path,
+        "backup_count = 7\n"
+        "appender.main = file test_config.log\n"
+        "appender.main.formatter = pattern %q\n"
+        "logger.cfg = INFO, main\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    assert(watcher.Generation() == 2 && logger->GetLevel() == Log4CPP::Level::DEBUG);
+    assert(Log4CPP::Configure::Instance().GetBackupCount() == 1);
+
+    // a file written in place is only read once closed.
+    remove(config_path);
+    {
+        std::ofstream out(config_path);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        assert(watcher.Generation() == 2 && logger->GetAppenders().size() == 1);
+        out << "backup_count = 1\n"
+               "appender.main = file test_config.log\n"
+               "appender.main.formatter = pattern %p %m\n"
+               "logger.cfg = DEBUG, main\n";
+    }
+    for(int wait = 0; wait < 500 && watcher.Generation() < 3; wait++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(watcher.Generation() == 3 && watcher.GetAppender("main") == main);
+
+    watcher.Stop();
+    main->Stop();
+
+    std::vector<std::string> lines = ReadLines(log_path);
+    assert(lines.size() == count + 1);
+    for(int index = 0; index < count; index++)
+        assert(lines[index].find("event " + std::to_string(index)) != std::string::npos);
+    assert(lines.back() == "DEBUG after reload");
+
+    Log4CPP::LoggerManager::Instance().Clear();
+    remove(config_path);
+    remove(log_path);
+    Log4CPP::Configure::Instance().SetBackupCount(0);
+}
+
+class CountingFormatter
+    : public Log4CPP::FileFormatter
+{
+public:
+    void FormatInto(const Log4CPP::LogEvent& e, Log4CPP::LogBuffer& out) override
+    {
+        _count++;
+        Log4CPP::FileFormatter::FormatInto(e, out);
+    }
+
+    std::atomic<int> _count{0};
+};
+
+void TestFanOut()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    // one writer thread, the appenders take turns on each event.
+    std::shared_ptr<Log4CPP::LogExecutor> executor(new Log4CPP::LogExecutor(1));
+    std::shared_ptr<CountingFormatter> shared_formatter(new CountingFormatter);
+    std::shared_ptr<CountingFormatter> own_formatter(new CountingFormatter);
+
+    std::vector<std::shared_ptr<LineCountAppender>> appenders;
+    for(int index = 0; index < 3; index++){
+        std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+        appender->SetFormatter(index < 2 ? shared_formatter : own_formatter);
+        appender->SetExecutor(executor);
+        appender->Start();
+        appenders.push_back(appender);
+    }
+
+    // fanned out through the parent too.
+    std::shared_ptr<Log4CPP::Logger> child = Log4CPP::Logger::GetLogger("fanout.child");
+    child->AddAppender(appenders[0]);
+    Log4CPP::Logger::GetLogger("fanout")->SetAppenders({appenders[1], appenders[2]});
+
+    const int count = 1000;
+    for(int index = 0; index < count; index++)
+        child->Info("fan out {} {}", index, std::string("text"));
+    // Stop() drains on the caller's thread, let the executor finish first.
+    for(auto& appender : appenders){
+        while( appender->GetMetrics().queue_depth > 0 )
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for(auto& appender : appenders)
+        appender->Stop();
+
+    // formatted once per formatter, every appender got every line.
+    assert(shared_formatter->_count == count);
+    assert(own_formatter->_count == count);
+    assert(appenders[0]->_lines.size() == count && appenders[0]->_lines == appenders[1]->_lines);
+    assert(appenders[2]->_lines == appenders[1]->_lines);
+    assert(appenders[0]->_lines[7].find("fan out 7 text") != std::string::npos);
+
+    // a single appender still gets the event itself.
+    Log4CPP::Logger::GetLogger("fanout")->SetAppenders({});
+    appenders[0]->Start();
+    child->Info("alone");
+    appenders[0]->Stop();
+    assert(appenders[0]->_lines.back().find("alone") != std::string::npos);
+    assert(shared_formatter->_count == count + 1);
+
+    // own writer threads pop an event at about the same time: one claims
+    // and formats the line, the other waits for it.
+    std::shared_ptr<CountingFormatter> threaded_formatter(new CountingFormatter);
+    std::vector<std::shared_ptr<Log4CPP::Appender>> threaded;
+    for(int index = 0; index < 2; index++){
+        std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+        appender->SetFormatter(threaded_formatter);
+        appender->Start();
+        threaded.push_back(appender);
+    }
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("fanout.threads");
+    logger->SetAppenders(threaded);
+    for(int index = 0; index < count; index++)
+        logger->Info("threads {}", index);
+    for(auto& appender : threaded)
+        appender->Stop();
+
+    assert(threaded_formatter->_count == count);
+    const std::vector<std::string>& lines = std::static_pointer_cast<LineCountAppender>(threaded[0])->_lines;
+    assert(lines.size() == count && lines == std::static_pointer_cast<LineCountAppender>(threaded[1])->_lines);
+
+    // more appenders than fit inline.
+    std::vector<std::shared_ptr<Log4CPP::Appender>> many;
+    for(int index = 0; index < 10; index++){
+        std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+        appender->SetFormatter(shared_formatter);
+        appender->Start();
+        many.push_back(appender);
+    }
+    logger->SetAppenders(many);
+    logger->Info("many");
+    for(auto& appender : many){
+        appender->Stop();
+        assert(std::static_pointer_cast<LineCountAppender>(appender)->_lines.size() == 1);
+    }
+
+    // a post blocked on a full queue doesn't hold up changing appenders.
+    std::shared_ptr<GateAppender> gate(new GateAppender);
+    gate->SetFormatter(shared_formatter);
+    gate->SetQueueCapacity(1);
+    gate->Start();
+    logger->SetAppenders({gate});
+
+    logger->Info("first");
+    gate->WaitEntered();
+    std::thread producer([&]{
+        for(int index = 0; index < 4; index++)
+            logger->Info("blocked {}", index);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::atomic_bool added{false};
+    std::thread adder([&]{
+        logger->AddAppender(appenders[0]);
+        added = true;
+    });
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while( !added && std::chrono::steady_clock::now() < end )
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(added);
+
+    gate->Open();
+    producer.join();
+    adder.join();
+    gate->Stop();
+    assert(gate->_lines.size() == 5);
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+void TestRateLimited()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(std::make_shared<Log4CPP::FileFormatter>());
+    appender->Start();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("limited");
+    logger->AddAppender(appender);
+
+    auto lines = [&]{
+        appender->Stop();
+        std::vector<std::string> lines;
+        lines.swap(appender->_lines);
+        appender->Start();
+        return lines;
+    };
+
+    for(int index = 0; index < 100; index++)
+        LOG_EVERY_N(logger, Error, 10, "every %d", index);
+    std::vector<std::string> every = lines();
+    assert(every.size() == 10);
+    assert(every[0].find("every 0") != std::string::npos && every[0].find("suppressed") == std::string::npos);
+    assert(every[1].find("every 10 [9 suppressed]") != std::string::npos);
+
+    for(int index = 0; index < 100; index++)
+        LOG_FIRST_N(logger, Error, 3, "first %d", index);
+    std::vector<std::string> first = lines();
+    assert(first.size() == 3 && first[2].find("first 2") != std::string::npos);
+
+    // one per 50ms over ~150ms.
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    int calls = 0;
+    while( std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(150) ){
+        LOG_EVERY_MS(logger, Error, 50, "timed %d", calls++);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::vector<std::string> timed = lines();
+    assert(timed.size() >= 2 && timed.size() <= 5);
+    assert(timed[1].find(" suppressed]") != std::string::npos);
+
+    // a burst of 5, then about one per ms.
+    for(int index = 0; index < 1000; index++)
+        LOG_RATE_LIMITED(logger, Error, 1000, 5, "bucket %d", index);
+    std::vector<std::string> bucket = lines();
+    assert(bucket.size() >= 5 && bucket.size() < 100);
+    assert(bucket[4].find("bucket 4") != std::string::npos);
+
+    // disabled levels neither log nor count.
+    logger->SetLevel(Log4CPP::Level::WARN);
+    for(int index = 0; index < 100; index++)
+        LOG_EVERY_N(logger, Info, 10, "disabled %d", index);
+    assert(lines().empty());
+
+    appender->Stop();
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+void TestCollapseRepeats()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    std::shared_ptr<LineCountAppender> appender(new LineCountAppender);
+    appender->SetFormatter(std::make_shared<Log4CPP::FileFormatter>());
+    appender->SetCollapseRepeats(true);
+    appender->Start();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("collapse");
+    logger->AddAppender(appender);
+
+    for(int index = 0; index < 5; index++)
+        logger->Error("same");
+    logger->Warn("same");
+    for(int index = 0; index < 3; index++)
+        logger->Info("value {}", 1);
+    logger->Info("value {}", 2);
+    logger->Info("value {}", 2);
+    appender->Stop();
+
+    // the run ends at a different event, then at Stop().
+    const std::vector<std::string>& lines = appender->_lines;
+    assert(lines.size() == 7);
+    assert(lines[0].find("[ERROR] same") != std::string::npos);
+    assert(lines[1].find("[ERROR] last message repeated 4 times") != std::string::npos);
+    assert(lines[2].find("[WARN]  same") != std::string::npos);
+    assert(lines[3].find("value 1") != std::string::npos);
+    assert(lines[4].find("last message repeated 2 times") != std::string::npos);
+    assert(lines[5].find("value 2") != std::string::npos);
+    assert(lines[6].find("last message repeated 1 times") != std::string::npos);
+
+    // a run still going is reported after the flush timeout, on an own
+    // writer thread as on a shared executor.
+    std::shared_ptr<Log4CPP::LogExecutor> executor(new Log4CPP::LogExecutor(1));
+    for(bool shared : {false, true}){
+        std::shared_ptr<LineCountAppender> timed(new LineCountAppender);
+        timed->SetFormatter(std::make_shared<Log4CPP::FileFormatter>());
+        timed->SetCollapseRepeats(true, 20);
+        if( shared )
+            timed->SetExecutor(executor);
+        timed->Start();
+        logger->SetAppenders({timed});
+
+        for(int index = 0; index < 10; index++)
+            logger->Error("burst");
+        for(int wait = 0; wait < 100 && timed->GetMetrics().lines < 2; wait++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        assert(timed->GetMetrics().lines == 2);
+
+        timed->Stop();
+        assert(timed->_lines.size() == 2 && timed->_lines[1].find("last message repeated 9 times") != std::string::npos);
+    }
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
+class CrashingFormatter
+    : public Log4CPP::FileFormatter
+{
+public:
+    void FormatInto(const Log4CPP::LogEvent& e, Log4CPP::LogBuffer& out) override
+    {
+        if( e.Text() == "boom" )
+            raise(SIGSEGV);
+        Log4CPP::FileFormatter::FormatInto(e, out);
+    }
+};
+
+/**
+ * main of "test crash <mode>", run by RunCrashChild: logs 100 lines to a
+ * buffering file appender, then crashes in abort() or, for "writer", in
+ * the formatter of another appender's writer thread.
+ */
+static int CrashChild(const std::string& mode)
+{
+    struct rlimit no_core = {0, 0};
+    setrlimit(RLIMIT_CORE, &no_core);
+    // long enough to fail the caller's time check if the handler waited it out.
+    Log4CPP::CrashHandler::Install(mode == "writer" ? 10000 : 1000);
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+
+    Log4CPP::FlushPolicy policy;
+    policy.bytes = 1024 * 1024;
+    std::shared_ptr<Log4CPP::FileAppender> file(new Log4CPP::FileAppender("test_crash.log"));
+    file->SetFormatter(std::make_shared<Log4CPP::FileFormatter>());
+    file->SetFlushPolicy(policy);
+    file->Start();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("crash");
+    logger->AddAppender(file);
+
+    std::shared_ptr<LineCountAppender> crashing(new LineCountAppender);
+    if( mode == "writer" ){
+        crashing->SetFormatter(std::make_shared<CrashingFormatter>());
+        crashing->Start();
+        logger->AddAppender(crashing);
+    }
+
+    for(int index = 0; index < 100; index++)
+        logger->Info("before crash {}", index);
+    if( mode != "writer" )
+        abort();
+
+    for(int wait = 0; wait < 1000 && file->GetMetrics().lines < 100; wait++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    logger->Info("boom");
+    for(;;)
+        pause();
+}
+
+// exit status of a fresh "test crash <mode>".
+static int RunCrashChild(const char* mode)
+{
+    pid_t pid = fork();
+    if( pid == 0 ){
+        execl("/proc/self/exe", "test", "crash", mode, static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    int status = 0;
+    assert(waitpid(pid, &status, 0) == pid);
+    return status;
+}
+
+void TestFlushPolicy()
+{
+    TEST_PROMPT(__FUNCTION__);
+
+    Log4CPP::Configure::Instance().SetLowestLevel(Log4CPP::Level::ALL);
+    Log4CPP::LoggerManager::Instance().Clear();
+
+    const std::string directory(Log4CPP::Configure::Instance().GetDirectory());
+    const std::string file_path = directory + "test_flush.log";
+    remove(file_path.c_str());
+
+    std::shared_ptr<Log4CPP::FileAppender> appender(new Log4CPP::FileAppender("test_flush.log"));
+    appender->SetFormatter(std::make_shared<Log4CPP::FileFormatter>());
+
+    Log4CPP::FlushPolicy policy;
+    policy.bytes = 1024 * 1024;
+    appender->SetFlushPolicy(policy);
+    appender->Start();
+    std::shared_ptr<Log4CPP::Logger> logger = Log4CPP::Logger::GetLogger("flush");
+    logger->AddAppender(appender);
+
+    auto wait_lines = [](const std::string& path, size_t count){
+        for(int wait = 0; wait < 100 && ReadLines(path).size() < count; wait++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return ReadLines(path).size();
+    };
+
+    // written, but still buffered.
+    for(int index = 0; index < 10; index++)
+        logger->Info("buffered {}", index);
+    for(int wait = 0; wait < 100 && appender->GetMetrics().lines < 10; wait++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(appender->GetMetrics().lines == 10);
+    assert(ReadLines(file_path).empty());
+
+    // an ERROR writes everything out at once.
+    logger->Error("flushed");
+    assert(wait_lines(file_path, 11) == 11);
+    assert(ReadLines(file_path)[10].find("[ERROR] flushed") != std::string::npos);
+
+    // so does the interval, without another event.
+    policy.interval_ms = 20;
+    appender->SetFlushPolicy(policy);
+    logger->Info("late");
+    assert(wait_lines(file_path, 12) == 12);
+
+    // and Stop().
+    policy.interval_ms = 0;
+    appender->SetFlushPolicy(policy);
+    logger->Info("stopped");
+    for(int wait = 0; wait < 100 && appender->GetMetrics().lines < 13; wait++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(ReadLines(file_path).size() == 12);
+    appender->Stop();
+    assert(ReadLines(file_path).size() == 13);
+    remove(file_path.c_str());
+
+    // a crash drains the queue and writes the buffer out before dying.
+    // the crashing process is a fresh exec of this test, a fork of this
+    // multi threaded one could hang on a lock another thread held.
+    const std::string crash_path = directory + "test_crash.log";
+    remove(crash_path.c_str());
+    int status = RunCrashChild("abort");
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    std::vector<std::string> lines = ReadLines(crash_path);
+    assert(lines.size() == 100);
+    assert(lines[99].find("before crash 99") != std::string::npos);
+    remove(crash_path.c_str());
+
+    // a crash on a writer thread doesn't wait for that writer.
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    status = RunCrashChild("writer");
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    assert(std::chrono::steady_clock::now() - begin < std::chrono::seconds(5));
+    lines = ReadLines(crash_path);
+    assert(lines.size() >= 100 && lines[99].find("before crash 99") != std::string::npos);
+    remove(crash_path.c_str());
+
+    Log4CPP::LoggerManager::Instance().Clear();
+}
+
 int main(int argc, char* argv[])
 {
+    if( argc == 3 && strcmp(argv[1], "crash") == 0 )
+        return CrashChild(argv[2]);
+
     TestConfigure();
+    TestRingQueue();
 
     TestInitLogger();
     TestConstructConsoleFormatter();
@@ -312,6 +2266,29 @@ int main(int argc, char* argv[])
     TestAppendConsoleLogByStreamAllType();
 
     TestHelper();
+    TestAppendBatch();
+    TestDeferredFormat();
+    TestTimestampCache();
+    TestLoggerLevel();
+    TestOverflowPolicy();
+    TestMmapFileAppender();
+    TestSharedExecutor();
+    TestBackupCompress();
+    TestMetrics();
+    TestThreadContext();
+    TestFormatInto();
+    TestPatternFormatter();
+    TestCheckedFormat();
+    TestStructuredLog();
+    TestBinaryFileAppender();
+    TestAsyncFileAppender();
+    TestConcurrentGetLogger();
+    TestLoggerHierarchy();
+    TestConfigWatcher();
+    TestFanOut();
+    TestRateLimited();
+    TestCollapseRepeats();
+    TestFlushPolicy();
     return 0;
 }
 
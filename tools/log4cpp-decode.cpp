@@ -0,0 +1,128 @@
+/**
+ * log4cpp-decode: turns BinaryFileAppender files back into the text of
+ * FileFormatter.
+ *
+ * usage: log4cpp-decode [--from TIME] [--to TIME] FILE...
+ *
+ * TIME is local "YYYYmmdd-HH:MM:SS" or seconds since the epoch; --from is
+ * inclusive, --to exclusive. a torn last record, e.g. after a crash, is
+ * reported on stderr and the rest of the file is still printed.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <string>
+#include <vector>
+
+#include "log4cpp.h"
+#include "logdecoder.h"
+
+namespace
+{
+struct Options
+{
+    bool has_from = false;
+    bool has_to = false;
+    time_t from = 0;
+    time_t to = 0;
+    std::vector<std::string> files;
+};
+
+bool ParseTime(const char* text, time_t& value)
+{
+    char* end = nullptr;
+    long long seconds = strtoll(text, &end, 10);
+    if( end != text && *end == '\0' ){
+        value = seconds;
+        return true;
+    }
+
+    struct tm local;
+    memset(&local, 0, sizeof(local));
+    end = strptime(text, "%Y%m%d-%H:%M:%S", &local);
+    if( end == nullptr || *end != '\0' )
+        return false;
+
+    local.tm_isdst = -1;
+    value = mktime(&local);
+    return true;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for(int index = 1; index < argc; index++){
+        const char* arg = argv[index];
+        const char* value = index + 1 < argc ? argv[index + 1] : nullptr;
+
+        if( strcmp(arg, "--from") == 0 && value ){
+            if( !ParseTime(value, options.from) )
+                return false;
+            options.has_from = true;
+            index++;
+        }else if( strcmp(arg, "--to") == 0 && value ){
+            if( !ParseTime(value, options.to) )
+                return false;
+            options.has_to = true;
+            index++;
+        }else if( arg[0] == '-' ){
+            return false;
+        }else{
+            options.files.push_back(arg);
+        }
+    }
+
+    return !options.files.empty();
+}
+
+bool InRange(const Options& options, const timeval& timestamp)
+{
+    if( options.has_from && timestamp.tv_sec < options.from )
+        return false;
+    if( options.has_to && timestamp.tv_sec >= options.to )
+        return false;
+
+    return true;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if( !ParseOptions(argc, argv, options) ){
+        fprintf(stderr, "usage: %s [--from TIME] [--to TIME] FILE...\n"
+            "TIME is YYYYmmdd-HH:MM:SS (local) or seconds since the epoch.\n", argv[0]);
+        return 2;
+    }
+
+    int status = 0;
+    Log4CPP::FileFormatter formatter;
+    Log4CPP::LogBuffer line;
+    for(const std::string& file : options.files){
+        Log4CPP::BinaryLogReader reader;
+        if( !reader.Open(file) ){
+            fprintf(stderr, "%s: not a log4cpp binary log\n", file.c_str());
+            status = 1;
+            continue;
+        }
+
+        Log4CPP::LogEvent e;
+        while( reader.Next(e) ){
+            if( !InRange(options, e.Timestamp()) )
+                continue;
+
+            line.Clear();
+            formatter.FormatInto(e, line);
+            line.Append('\n');
+            fwrite(line.Data(), 1, line.Size(), stdout);
+        }
+
+        if( reader.Skipped() > 0 )
+            fprintf(stderr, "%s: skipped %llu corrupt records\n", file.c_str(), (unsigned long long)reader.Skipped());
+        if( reader.Truncated() )
+            fprintf(stderr, "%s: stopped at a torn or unknown record\n", file.c_str());
+    }
+
+    return status;
+}